@@ -29,6 +29,76 @@ async function compile(url) {
 
 let wasm_module_promise = null;
 let wasm_simd_module_promise = compile(new URL("showcqt-simd.wasm", import.meta.url));
+let wasm_mt_module_promise = null;
+// the engines of make stats, compiled on first use by name
+let wasm_stats_module_promises = {};
+
+function stats_module(name) {
+    if (!wasm_stats_module_promises[name])
+        wasm_stats_module_promises[name] = compile(new URL(name, import.meta.url));
+    return wasm_stats_module_promises[name];
+}
+
+// LRU of serialized kernels shared by all instances, keyed by (simd, rate, width, supersampling, mono, multires, compact, range)
+let kernel_cache = new Map();
+
+let kernel_cache_key = function(simd, rate, width, supersampling, mono, multires, compact, fmin, fmax) {
+    return [simd ? 1 : 0, rate, width, supersampling ? 1 : 0, mono ? 1 : 0, multires && !mono ? 1 : 0, compact ? 1 : 0,
+            fmin, fmax].join(",");
+};
+
+// input_dec() in showcqt.c, the kernel of a decimated rate is that of rate / input_dec
+let input_dec = function(rate, flags) {
+    var dec = flags & ShowCQT.DECIMATE ? Math.min(8, Math.max(1, Math.floor(rate / 44100))) : 1;
+    while (rate % dec)
+        dec--;
+    return dec;
+};
+
+// DEFAULT_FMIN and DEFAULT_FMAX in showcqt.h, E0 to E10
+let default_range = [20.01523126408007475, 20495.59681441799654];
+
+// a lowered ShowCQT.kernel_cache_size drops the least recently used blobs at the next lookup
+let kernel_cache_trim = function() {
+    while (kernel_cache.size > ShowCQT.kernel_cache_size)
+        kernel_cache.delete(kernel_cache.keys().next().value);
+};
+
+let kernel_cache_get = function(key) {
+    kernel_cache_trim();
+    var blob = kernel_cache.get(key);
+    if (blob) {
+        kernel_cache.delete(key);
+        kernel_cache.set(key, blob);
+    }
+    return blob;
+};
+
+let kernel_cache_put = function(key, blob) {
+    kernel_cache.delete(key);
+    kernel_cache.set(key, blob);
+    kernel_cache_trim();
+};
+
+// rects returned by render_frame_delta(), past them the changes are merged into the last one
+let max_rects = 64;
+
+// offsets and strides in bytes of the planes of a frame, see FORMAT_* in showcqt.h
+let frame_layout = function(format, width, rows) {
+    var cw = (width + 1) >> 1, ch = (rows + 1) >> 1;
+    switch (format) {
+        case ShowCQT.RGB565:
+            return {size: 2 * width * rows, stride: 2 * width};
+        case ShowCQT.I420:
+            return {size: width * rows + 2 * cw * ch, stride: width, u: width * rows, v: width * rows + cw * ch, stride_c: cw};
+        case ShowCQT.NV12:
+            return {size: width * rows + 2 * cw * ch, stride: width, u: width * rows, v: 0, stride_c: 2 * cw};
+        case ShowCQT.RGBA:
+        case ShowCQT.BGRA:
+            return {size: 4 * width * rows, stride: 4 * width};
+    }
+    throw new Error("ShowCQT set_frame_format: unknown format");
+};
 
 let invalid_func = function() {
     throw new Error("ShowCQT is not initialized");
@@ -36,93 +106,526 @@ let invalid_func = function() {
 
 let cqt_uninit = function(cqt) {
     cqt.fft_size = 0;
+    cqt.input_dec = 1;
     cqt.width = 0;
     cqt.inputs = null;
     cqt.output = null;
     cqt.color = null;
+    cqt.frame = null;
+    cqt.frame_height = 0;
+    cqt.frame_format = ShowCQT.RGBA;
+    cqt.frame_planes = null;
+    cqt.sono = null;
+    cqt.sono_lines = 0;
     cqt.calc = invalid_func;
+    cqt.calc_batch = invalid_func;
+    cqt.load_batch_frame = invalid_func;
+    cqt.batch_time = 0;
     cqt.render_line_alpha = invalid_func;
     cqt.render_line_opaque = invalid_func;
+    cqt.render_frame = invalid_func;
+    cqt.render_frame_delta = invalid_func;
+    cqt.render_sono = invalid_func;
+    cqt.set_frame_format = invalid_func;
+    cqt.get_sono_head = invalid_func;
     cqt.set_height = invalid_func;
     cqt.set_volume = invalid_func;
+    cqt.set_palette = invalid_func;
+    cqt.push_samples = invalid_func;
+    cqt.push_samples_interleaved = invalid_func;
+    cqt.get_input_pos = invalid_func;
     cqt.detect_silence = invalid_func;
+    cqt.export_kernel = invalid_func;
 };
 
 var ShowCQT = {
     instantiate: async function(opt) {
         var instance = null;
         var simd = true;
+        var is_simd = false;
+        var threads = 0;
+        var stats = !!(opt && opt.stats);
+        var mt_module = null;
+        var workers = [];
         if (opt && opt.simd !== undefined)
             simd = opt.simd;
+        if (opt && opt.threads > 1)
+            threads = Math.floor(opt.threads);
 
         var env = {
             cos: Math.cos,
             sin: Math.sin,
             log: Math.log,
             exp: Math.exp,
+            clock_ms: () => performance.now(),
             memory_expand
         };
 
-        if (simd) {
+        if (simd && threads) {
+            try {
+                if (!wasm_mt_module_promise && !stats)
+                    wasm_mt_module_promise = compile(new URL("showcqt-simd-mt.wasm", import.meta.url));
+                mt_module = await (stats ? stats_module("showcqt-simd-mt-stats.wasm") : wasm_mt_module_promise);
+                env.memory = new WebAssembly.Memory({initial: 16, maximum: 16384, shared: true});
+                instance = await WebAssembly.instantiate(mt_module, {env});
+                is_simd = true;
+            } catch(e) {
+                console.warn(`Failed to instantiate threaded code. ${e.name}: ${e.message}. Fallback to single thread.`);
+                delete env.memory;
+                instance = mt_module = null;
+                threads = 0;
+            }
+        }
+        if (simd && !instance) {
             try {
-                instance = await WebAssembly.instantiate(await wasm_simd_module_promise, {env});
+                instance = await WebAssembly.instantiate(await (stats ? stats_module("showcqt-simd-stats.wasm") :
+                                                                wasm_simd_module_promise), {env});
+                is_simd = true;
             } catch(e) {
                 console.warn(`Failed to instantiate SIMD code. ${e.name}: ${e.message}. Fallback to legacy code.`);
             }
         }
         if (!instance) {
-            if (!wasm_module_promise)
+            if (!wasm_module_promise && !stats)
                 wasm_module_promise = compile(new URL("showcqt.wasm", import.meta.url));
-            instance = await WebAssembly.instantiate(await wasm_module_promise, {env});
+            instance = await WebAssembly.instantiate(await (stats ? stats_module("showcqt-stats.wasm") : wasm_module_promise), {env});
         }
         var exports = instance.exports;
-        var memory = exports.memory;
-        var start_ptr = memory.buffer.byteLength;
-        var curr_ptr = start_ptr;
+        var memory = env.memory || exports.memory;
+        var curr_ptr = memory.buffer.byteLength;
         var avail_size = 0;
+        var buffer = memory.buffer;
+        var contexts = new Set();
 
+        // one grow for the whole request, init() allocates all tables of a context in one block
         function memory_expand(size) {
-            if (size < 0) {
-                avail_size += curr_ptr - start_ptr;
-                curr_ptr = start_ptr;
-                return 0;
+            if (avail_size < size) {
+                var pages = Math.ceil((size - avail_size) / 65536);
+                memory.grow(pages);
+                avail_size += 65536 * pages;
             }
 
-            while (avail_size < size)
-                memory.grow(1), avail_size += 65536;
-
             var ret_ptr = curr_ptr;
             curr_ptr += size;
             avail_size -= size;
             return ret_ptr;
         }
 
-        var retval = {
-            init: function(rate, width, height, bar_v, sono_v, supersampling) {
-                cqt_uninit(this);
-                this.fft_size = exports.init(rate, width, height, bar_v, sono_v, supersampling);
-                if (!this.fft_size)
-                    throw new Error("ShowCQT init: cannot initialize ShowCQT");
-                this.width = width;
-                this.inputs = [
-                    new Float32Array(memory.buffer, exports.get_input_array(0), this.fft_size),
-                    new Float32Array(memory.buffer, exports.get_input_array(1), this.fft_size)
+        // memory.grow detaches every view, rebind the views of all contexts
+        function update_views() {
+            if (buffer === memory.buffer)
+                return;
+            buffer = memory.buffer;
+            for (var bind_views of contexts)
+                bind_views();
+        }
+
+        // Workers run calc() stages in parallel with the calling thread, they only ever
+        // execute worker_run() and never allocate.
+        async function spawn_workers() {
+            var Worker = globalThis.Worker || (await IMPORT("node:worker_threads")).Worker;
+            var url = new URL("showcqt-worker.mjs", import.meta.url);
+            for (var index = 1; index < threads; index++) {
+                var stack = exports.memory_alloc(65536);
+                var worker = new Worker(url, {type: "module"});
+                if (worker.unref)
+                    worker.unref();
+                worker.postMessage({module: mt_module, memory, index, stack_top: stack + 65536});
+                workers.push(worker);
+            }
+            update_views();
+            for (var t = 0; t < 5000 && exports.pool_ready() < threads - 1; t++)
+                await new Promise(resolve => setTimeout(resolve, 1));
+            threads = exports.pool_set_threads(threads);
+            if (threads < workers.length + 1)
+                console.warn(`Only ${threads - 1} of ${workers.length} ShowCQT workers started.`);
+        }
+
+        function terminate_threads() {
+            if (mt_module)
+                exports.pool_set_threads(1);
+            for (var worker of workers)
+                worker.terminate();
+            workers = [];
+            threads = 0;
+        }
+
+        function create_context() {
+            var ctx = exports.create();
+            var frame_ptr = 0;
+            var frame_rows = 0;
+            var frame_format = 0;
+            var layout = null;
+            var push_ptr = 0;
+            var batch_ptr = 0;
+            var rect_ptr = 0;
+            var delta_dirty = true;
+            var batch_size = 0;
+            var batch_colors = 0;
+            var batch_frames = 0;
+            var sono_rows = 0;
+            var blob = null;
+            var range = default_range;
+            var range_key = null;
+
+            function release() {
+                if (frame_ptr)
+                    exports.memory_free(frame_ptr);
+                if (push_ptr)
+                    exports.memory_free(push_ptr);
+                if (batch_ptr)
+                    exports.memory_free(batch_ptr);
+                if (rect_ptr)
+                    exports.memory_free(rect_ptr);
+                frame_ptr = 0;
+                rect_ptr = 0;
+                delta_dirty = true;
+                frame_format = 0;
+                layout = null;
+                push_ptr = 0;
+                batch_ptr = batch_size = batch_colors = batch_frames = 0;
+                frame_rows = 0;
+                sono_rows = 0;
+            }
+
+            function bind_views() {
+                if (!context.fft_size)
+                    return;
+                var width = context.width;
+                context.inputs = [
+                    new Float32Array(memory.buffer, exports.get_input_array(ctx, 0), context.fft_size),
+                    new Float32Array(memory.buffer, exports.get_input_array(ctx, 1), context.fft_size)
                 ];
-                this.color = new Float32Array(memory.buffer, exports.get_color_array(), this.width * 4);
-                this.output = new Uint8ClampedArray(memory.buffer, exports.get_output_array(), this.width * 4);
-                this.calc = exports.calc;
-                this.render_line_alpha = exports.render_line_alpha;
-                this.render_line_opaque = exports.render_line_opaque;
-                this.set_height = exports.set_height;
-                this.set_volume = exports.set_volume;
-                this.detect_silence = exports.detect_silence;
+                context.color = new Float32Array(memory.buffer, exports.get_color_array(ctx), width * 4);
+                context.output = new Uint8ClampedArray(memory.buffer, exports.get_output_array(ctx), width * 4);
+                if (frame_rows)
+                    context.frame = new Uint8ClampedArray(memory.buffer, frame_ptr, layout.size);
+                if (sono_rows)
+                    context.sono = new Uint8ClampedArray(memory.buffer, exports.get_sono_array(ctx), 4 * width * sono_rows);
             }
-        };
-        cqt_uninit(retval);
-        return retval;
+
+            function init_import(blob, rate, width, height, bar_v, sono_v, supersampling, flags) {
+                var ptr = exports.memory_alloc(blob.length);
+                new Uint8Array(memory.buffer, ptr, blob.length).set(blob);
+                var fft_size = exports.init_import(ctx, rate, width, height, bar_v, sono_v, supersampling, flags, ptr, blob.length);
+                exports.memory_free(ptr);
+                return fft_size;
+            }
+
+            // samples per channel that fill the ring, decimation needs up to 1024 more for its lowpass taps
+            function push_size(fft_size) {
+                return context.input_dec > 1 ? (fft_size + 1024) * context.input_dec : fft_size;
+            }
+
+            // Stage at most push_size() new samples per channel in wasm memory, push_samples() copies them into the ring.
+            function push(samples, right, stride) {
+                if (right && right.length != samples.length)
+                    throw new Error("ShowCQT push_samples: left and right differ in length");
+                var n = Math.min(samples.length / stride, push_size(context.fft_size)) | 0;
+                var view = new Float32Array(memory.buffer, push_ptr, 2 * n);
+                view.set(samples.subarray(samples.length - stride * n));
+                if (right && stride == 1)
+                    view.set(right.subarray(right.length - n), n);
+                var right_ptr = stride == 2 ? push_ptr + 4 : right ? push_ptr + 4 * n : 0;
+                exports.push_samples(ctx, push_ptr, right_ptr, n, stride);
+            }
+
+            // The span and the colors share one staging buffer, kept until a larger batch needs more.
+            function batch(left, right, n, hop) {
+                n = n | 0;
+                hop = hop | 0;
+                var len = (n - 1) * hop + context.fft_size;
+                if (n < 1 || hop < 1 || left.length < len || (right && right.length < len))
+                    throw new Error("ShowCQT calc_batch: input is shorter than (n - 1) * hop + fft_size");
+                var size = 8 * len + 16 * context.width * n;
+                if (size > batch_size) {
+                    if (batch_ptr)
+                        exports.memory_free(batch_ptr);
+                    batch_ptr = exports.memory_alloc(size);
+                    batch_size = size;
+                    update_views();
+                }
+                var view = new Float32Array(memory.buffer, batch_ptr, 2 * len);
+                view.set(left.subarray(0, len));
+                if (right)
+                    view.set(right.subarray(0, len), len);
+                batch_colors = batch_ptr + 8 * len;
+                batch_frames = n;
+                var t = performance.now();
+                exports.calc_batch(ctx, batch_ptr, right ? batch_ptr + 4 * len : 0, n, hop, batch_colors);
+                context.batch_time = performance.now() - t;
+                return new Float32Array(memory.buffer, batch_colors, 4 * context.width * n);
+            }
+
+            function kernel_export() {
+                var size = exports.kernel_export_size(ctx);
+                var ptr = exports.memory_alloc(size);
+                exports.kernel_export(ctx, ptr);
+                var blob = new Uint8Array(memory.buffer.slice(ptr, ptr + size));
+                exports.memory_free(ptr);
+                // memory_alloc() may have grown the memory under export_kernel()
+                update_views();
+                return blob;
+            }
+
+            var context = {
+                init: function(rate, width, height, bar_v, sono_v, supersampling, frame_height, sono_lines, flags) {
+                    cqt_uninit(this);
+                    release();
+                    // true is ShowCQT.MONO
+                    flags = flags | 0;
+                    var key_rate = rate / input_dec(rate, flags);
+                    range_key = ([fmin, fmax]) => kernel_cache_key(is_simd, key_rate, width, supersampling, flags & ShowCQT.MONO,
+                                                                   flags & ShowCQT.MULTIRES, flags & ShowCQT.COMPACT, fmin, fmax);
+                    var key = range_key(range);
+                    blob = kernel_cache_get(key);
+                    if (blob)
+                        this.fft_size = init_import(blob, rate, width, height, bar_v, sono_v, supersampling, flags);
+                    if (!this.fft_size) {
+                        kernel_cache.delete(key);
+                        this.fft_size = exports.init(ctx, rate, width, height, bar_v, sono_v, supersampling, flags);
+                        if (!this.fft_size) {
+                            update_views();
+                            throw new Error("ShowCQT init: cannot initialize ShowCQT");
+                        }
+                        // without a cache the blob is only made by export_kernel()
+                        blob = null;
+                        if (ShowCQT.kernel_cache_size > 0)
+                            kernel_cache_put(key, blob = kernel_export());
+                    }
+                    this.width = width;
+                    sono_rows = sono_lines > 0 ? Math.floor(sono_lines) : 0;
+                    if (sono_rows && !exports.init_sono(ctx, sono_rows)) {
+                        this.fft_size = sono_rows = 0;
+                        update_views();
+                        throw new Error("ShowCQT init: cannot initialize sonogram history");
+                    }
+                    frame_rows = frame_height > 0 ? Math.floor(frame_height) : 0;
+                    layout = frame_layout(ShowCQT.RGBA, width, frame_rows);
+                    if (frame_rows)
+                        frame_ptr = exports.memory_alloc(layout.size);
+                    this.input_dec = exports.get_input_dec(ctx);
+                    push_ptr = exports.memory_alloc(8 * push_size(this.fft_size));
+                    update_views();
+                    bind_views();
+
+                    this.export_kernel = () => (blob = blob || kernel_export()).slice();
+                    // true if the previous frame was reused, see set_skip_static()
+                    this.calc = () => !!exports.calc(ctx);
+                    this.calc_batch = batch;
+                    this.load_batch_frame = function(k) {
+                        k = k | 0;
+                        if (k < 0 || k >= batch_frames)
+                            throw new Error("ShowCQT load_batch_frame: no such frame in the last batch");
+                        exports.load_color(ctx, batch_colors + 16 * width * k);
+                    };
+                    this.push_samples = (left, right) => push(left, right, 1);
+                    this.push_samples_interleaved = (samples) => push(samples, null, 2);
+                    this.get_input_pos = () => exports.get_input_pos(ctx);
+                    this.render_line_alpha = (y, alpha) => exports.render_line_alpha(ctx, y, alpha);
+                    this.render_line_opaque = (y) => exports.render_line_opaque(ctx, y);
+                    // rows [y0, y1) of cqt.frame, 4:2:0 formats render whole row pairs
+                    var render_rows = function(y0, y1, alpha, sono_order) {
+                        var yuv = frame_format == ShowCQT.I420 || frame_format == ShowCQT.NV12;
+                        alpha = alpha === undefined ? 255 : alpha;
+                        delta_dirty = true;
+                        if (!frame_format && sono_order === undefined)
+                            return exports.render_frame(ctx, y0, y1, alpha, frame_ptr + 4 * width * y0, width);
+                        if (!frame_format)
+                            return exports.render_sono(ctx, sono_order, alpha, frame_ptr + 4 * width * y0, width);
+                        if (yuv && sono_order !== undefined && y0 & 1)
+                            throw new Error("ShowCQT render_sono: 4:2:0 formats need an even row");
+                        if (yuv) {
+                            y0 &= ~1;
+                            y1 = Math.min(frame_rows, (y1 + 1) & ~1);
+                        }
+                        var {stride, u, v, stride_c} = layout;
+                        var args = [frame_format, frame_ptr + stride * y0, stride,
+                                    u ? frame_ptr + u + stride_c * (y0 >> 1) : 0, v ? frame_ptr + v + stride_c * (y0 >> 1) : 0, stride_c | 0];
+                        if (sono_order === undefined)
+                            exports.render_frame_format(ctx, y0, y1, alpha, ...args);
+                        else
+                            exports.render_sono_format(ctx, sono_order, alpha, ...args);
+                    };
+                    if (frame_rows) {
+                        this.frame_height = frame_rows;
+                        this.frame_planes = {stride: layout.stride, u: layout.u, v: layout.v, stride_c: layout.stride_c};
+                        this.render_frame = function(y0, y1, alpha) {
+                            y0 = Math.max(0, y0 | 0);
+                            y1 = Math.min(frame_rows, y1 | 0);
+                            if (y0 < y1)
+                                render_rows(y0, y1, alpha);
+                        };
+                        // render_frame(0, y1, alpha) redrawing only what changed since the last call,
+                        // returns the redrawn {x, y, width, height}, RGBA only
+                        this.render_frame_delta = function(y1, alpha) {
+                            if (frame_format)
+                                throw new Error("ShowCQT render_frame_delta: needs the RGBA frame format");
+                            y1 = Math.max(0, Math.min(frame_rows, y1 === undefined ? frame_rows : y1 | 0));
+                            alpha = alpha === undefined ? 255 : alpha;
+                            if (!rect_ptr)
+                                rect_ptr = exports.memory_alloc(16 * max_rects);
+                            // other renders into the frame make the next delta redraw all
+                            if (delta_dirty)
+                                exports.delta_invalidate(ctx);
+                            delta_dirty = false;
+                            var count = exports.render_frame_delta(ctx, y1, alpha, frame_ptr, width, rect_ptr, max_rects);
+                            var r = new Int32Array(memory.buffer, rect_ptr, 4 * count);
+                            var rects = [];
+                            for (let k = 0; k < 4 * count; k += 4)
+                                rects.push({x: r[k], y: r[k+1], width: r[k+2], height: r[k+3]});
+                            return rects;
+                        };
+                        this.set_frame_format = function(format) {
+                            var next = frame_layout(format, width, frame_rows);
+                            exports.memory_free(frame_ptr);
+                            frame_ptr = exports.memory_alloc(next.size);
+                            frame_format = format;
+                            delta_dirty = true;
+                            layout = next;
+                            this.frame_format = format;
+                            this.frame_planes = {stride: next.stride, u: next.u, v: next.v, stride_c: next.stride_c};
+                            update_views();
+                            bind_views();
+                        };
+                    }
+                    if (sono_rows) {
+                        this.sono_lines = sono_rows;
+                        this.get_sono_head = () => exports.get_sono_head(ctx);
+                        this.render_sono = function(y, order, alpha) {
+                            y = y | 0;
+                            if (y < 0 || y + sono_rows > frame_rows)
+                                throw new Error("ShowCQT render_sono: sonogram does not fit in frame");
+                            render_rows(y, y + sono_rows, alpha, order ? 1 : 0);
+                        };
+                    }
+                    this.set_height = (height) => exports.set_height(ctx, height);
+                    this.set_volume = (bar_v, sono_v) => exports.set_volume(ctx, bar_v, sono_v);
+                    this.set_palette = (r, g, b) => exports.set_palette(ctx, r, g, b);
+                    this.detect_silence = (threshold) => exports.detect_silence(ctx, threshold);
+                    // allocates the copy of the input ring it compares
+                    this.set_skip_static = (silence) => {
+                        exports.set_skip_static(ctx, silence === undefined ? 0 : silence);
+                        update_views();
+                    };
+                    this.set_smoothing = (attack, decay) => exports.set_smoothing(ctx, attack, decay);
+                    this.set_peak = (hold, fall) => exports.set_peak(ctx, hold, fall);
+                },
+
+                // Frequency range of the bins, kept across init(), (0, 0) restores E0 to E10. An initialized
+                // context gets new tables and fft_size right away, bins whose window does not change keep
+                // their kernel. cqt.inputs are rebound and their contents dropped.
+                set_range: function(fmin, fmax) {
+                    var next = !fmin && !fmax ? default_range : [+fmin, +fmax];
+                    var fft_size = exports.set_range(ctx, next[0], next[1]);
+                    if (!fft_size)
+                        throw new Error("ShowCQT set_range: invalid range");
+                    range = next;
+                    if (!this.fft_size)
+                        return;
+                    if (fft_size > this.fft_size) {
+                        exports.memory_free(push_ptr);
+                        push_ptr = exports.memory_alloc(8 * push_size(fft_size));
+                    }
+                    this.fft_size = fft_size;
+                    var key = range_key(range);
+                    blob = kernel_cache_get(key) || null;
+                    if (!blob && ShowCQT.kernel_cache_size > 0)
+                        blob = kernel_export();
+                    if (blob)
+                        kernel_cache_put(key, blob);
+                    update_views();
+                    bind_views();
+                },
+
+                // Per stage timing of calc() and of the prerender done by the first render after it,
+                // off by default. set_timing() clears the times, get_stage_times() returns the ms spent in each.
+                set_timing: (on) => exports.set_timing(ctx, on ? 1 : 0),
+                get_stage_times: function() {
+                    var t = new Float64Array(memory.buffer, exports.get_stage_times(ctx), ShowCQT.STAGES.length);
+                    var ret = {};
+                    ShowCQT.STAGES.forEach((name, k) => ret[name] = t[k]);
+                    return ret;
+                },
+
+                // Counters of the calc and render calls since creation or reset_stats(), see ShowCQT.STATS.
+                // Only the engine of make stats, instantiate({stats: true}), keeps them, otherwise get_stats() returns null.
+                get_stats: function() {
+                    var ptr = exports.get_stats(ctx);
+                    if (!ptr)
+                        return null;
+                    var s = new Float64Array(memory.buffer, ptr, ShowCQT.STATS.length);
+                    var ret = {};
+                    ShowCQT.STATS.forEach((name, k) => ret[name] = s[k]);
+                    return ret;
+                },
+                reset_stats: () => exports.reset_stats(ctx),
+
+                // Create another context in the same wasm instance. Contexts with the same
+                // (rate, width, supersampling, flags, range) share their tables and kernel.
+                create_context: create_context,
+
+                // Stop the calc() workers of this instance, calc() then runs on the calling thread only.
+                terminate_threads: terminate_threads,
+
+                destroy: function() {
+                    cqt_uninit(this);
+                    release();
+                    contexts.delete(bind_views);
+                    exports.destroy(ctx);
+                    this.init = this.destroy = invalid_func;
+                }
+            };
+            contexts.add(bind_views);
+            cqt_uninit(context);
+            update_views();
+            return context;
+        }
+
+        if (threads)
+            await spawn_workers();
+        return create_context();
     }
 };
 
+ShowCQT.kernel_cache_size = 4;
+
+// init() flags, see INIT_MONO, INIT_MULTIRES, INIT_COMPACT and INIT_DECIMATE in showcqt.h
+ShowCQT.MONO = 1;
+ShowCQT.MULTIRES = 2;
+ShowCQT.COMPACT = 4;
+ShowCQT.DECIMATE = 8;
+
+// cqt.set_frame_format() formats, see FORMAT_* in showcqt.h
+ShowCQT.RGBA = 0;
+ShowCQT.BGRA = 1;
+ShowCQT.RGB565 = 2;
+ShowCQT.I420 = 3;
+ShowCQT.NV12 = 4;
+
+// keys of cqt.get_stage_times(), in the order of STAGE_* in showcqt.h
+ShowCQT.STAGES = ["input", "fft", "kernel", "finish", "prerender"];
+
+// keys of cqt.get_stats(), in the order of STAT_* in showcqt.h, times are in ms
+ShowCQT.STATS = ["calc_calls", "calc_time", "calc_max", "render_calls", "render_time", "render_max",
+                 "kernel_taps", "bins_skipped", "transparent_rows", "prerenders"];
+
+// Add a blob returned by cqt.export_kernel() (e.g. restored from IndexedDB or disk) to the kernel cache.
+ShowCQT.import_kernel = function(blob) {
+    blob = new Uint8Array(blob.buffer ? blob.buffer.slice(blob.byteOffset, blob.byteOffset + blob.byteLength) : blob);
+    if (blob.length < 80)
+        return false;
+    var view = new DataView(blob.buffer);
+    // magic "SCQK", see KernelBlobHeader in showcqt.h
+    if (view.getUint32(0, true) != 0x4B514353)
+        return false;
+    var key = kernel_cache_key(view.getInt32(8, true), view.getInt32(12, true), view.getInt32(16, true), view.getInt32(20, true),
+                               view.getInt32(40, true), view.getInt32(44, true), view.getInt32(60, true),
+                               view.getFloat64(64, true), view.getFloat64(72, true));
+    kernel_cache_put(key, blob);
+    return true;
+};
+
 ShowCQT.version = "2.2.2";
 export { ShowCQT };
 export default ShowCQT;
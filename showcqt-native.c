@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2020 Muhammad Faiz <mfcc64@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* Native runtime of showcqt.c: memory_expand(), clock_ms() and the dispatch between the
+ * scalar, avx2 and avx512 builds of the engine, see the native target of Makefile. */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "showcqt.h"
+#include "showcqt-native.h"
+
+#define SHOWCQT_PUBLIC __attribute__((__visibility__("default")))
+
+extern const ShowCQTApi showcqt_api_scalar;
+extern const ShowCQTApi showcqt_api_avx2;
+extern const ShowCQTApi showcqt_api_avx512;
+
+/* like wasm memory, one contiguous range growing at the end and never shrinking.
+ * Each isa has its own range, the allocator of each build assumes nobody else grows it. */
+#define MEMORY_RESERVE ((size_t) 4 << 30)
+
+static struct {
+    uint8_t    *base;
+    size_t      used;
+} memory[SHOWCQT_ISA_AVX512 + 1];
+
+static int api_isa;
+
+void *memory_expand(int size)
+{
+    if (!memory[api_isa].base) {
+        void *p = mmap(0, MEMORY_RESERVE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED)
+            abort();
+        memory[api_isa].base = p;
+    }
+
+    if (size < 0 || (size_t) size > MEMORY_RESERVE - memory[api_isa].used)
+        abort();
+
+    void *ret = memory[api_isa].base + memory[api_isa].used;
+    memory[api_isa].used += size;
+    return ret;
+}
+
+double clock_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+/* the allocator and the tables list of the engine are global, functions that touch them are serialized */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static const ShowCQTApi *api;
+static int contexts;
+
+static int isa_supported(int isa)
+{
+    __builtin_cpu_init();
+    switch (isa) {
+        case SHOWCQT_ISA_SCALAR:
+            return 1;
+        case SHOWCQT_ISA_AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case SHOWCQT_ISA_AVX512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") &&
+                   __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512bw") &&
+                   __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    }
+    return 0;
+}
+
+static int select_isa(int isa)
+{
+    static const ShowCQTApi *const table[] = { 0, &showcqt_api_scalar, &showcqt_api_avx2, &showcqt_api_avx512 };
+
+    if (isa == SHOWCQT_ISA_AUTO)
+        for (isa = SHOWCQT_ISA_AVX512; !isa_supported(isa); isa--);
+    else if (isa < SHOWCQT_ISA_SCALAR || isa > SHOWCQT_ISA_AVX512 || !isa_supported(isa))
+        return 0;
+
+    if (contexts && isa != api_isa)
+        return 0;
+
+    api = table[isa];
+    api_isa = isa;
+    return isa;
+}
+
+static ALWAYS_INLINE const ShowCQTApi *get_api(void)
+{
+    if (!api)
+        select_isa(SHOWCQT_ISA_AUTO);
+    return api;
+}
+
+SHOWCQT_PUBLIC int showcqt_set_isa(int isa)
+{
+    pthread_mutex_lock(&lock);
+    isa = select_isa(isa);
+    pthread_mutex_unlock(&lock);
+    return isa;
+}
+
+SHOWCQT_PUBLIC int showcqt_get_isa(void)
+{
+    pthread_mutex_lock(&lock);
+    int isa = get_api() ? api_isa : 0;
+    pthread_mutex_unlock(&lock);
+    return isa;
+}
+
+SHOWCQT_PUBLIC const char *showcqt_isa_name(int isa)
+{
+    static const char *const name[] = { "auto", "scalar", "avx2", "avx512" };
+    return isa >= SHOWCQT_ISA_AUTO && isa <= SHOWCQT_ISA_AVX512 ? name[isa] : "unknown";
+}
+
+SHOWCQT_PUBLIC ShowCQT *showcqt_create(void)
+{
+    pthread_mutex_lock(&lock);
+    ShowCQT *cqt = get_api()->create();
+    contexts++;
+    pthread_mutex_unlock(&lock);
+    return cqt;
+}
+
+SHOWCQT_PUBLIC void showcqt_destroy(ShowCQT *cqt)
+{
+    if (!cqt)
+        return;
+    pthread_mutex_lock(&lock);
+    api->destroy(cqt);
+    contexts--;
+    pthread_mutex_unlock(&lock);
+}
+
+SHOWCQT_PUBLIC int showcqt_init(ShowCQT *cqt, int rate, int width, int height, float bar_v, float sono_v, int super, int flags)
+{
+    pthread_mutex_lock(&lock);
+    int ret = api->init(cqt, rate, width, height, bar_v, sono_v, super, flags);
+    pthread_mutex_unlock(&lock);
+    return ret;
+}
+
+SHOWCQT_PUBLIC int showcqt_init_import(ShowCQT *cqt, int rate, int width, int height, float bar_v, float sono_v, int super,
+                                       int flags, const void *blob, int size)
+{
+    pthread_mutex_lock(&lock);
+    int ret = api->init_import(cqt, rate, width, height, bar_v, sono_v, super, flags, blob, size);
+    pthread_mutex_unlock(&lock);
+    return ret;
+}
+
+SHOWCQT_PUBLIC int showcqt_kernel_export_size(ShowCQT *cqt)
+{
+    return api->kernel_export_size(cqt);
+}
+
+SHOWCQT_PUBLIC int showcqt_kernel_export(ShowCQT *cqt, void *blob)
+{
+    return api->kernel_export(cqt, blob);
+}
+
+SHOWCQT_PUBLIC int showcqt_init_sono(ShowCQT *cqt, int lines)
+{
+    pthread_mutex_lock(&lock);
+    int ret = api->init_sono(cqt, lines);
+    pthread_mutex_unlock(&lock);
+    return ret;
+}
+
+SHOWCQT_PUBLIC int showcqt_set_range(ShowCQT *cqt, double fmin, double fmax)
+{
+    pthread_mutex_lock(&lock);
+    int ret = api->set_range(cqt, fmin, fmax);
+    pthread_mutex_unlock(&lock);
+    return ret;
+}
+
+SHOWCQT_PUBLIC void showcqt_set_timing(ShowCQT *cqt, int on)
+{
+    api->set_timing(cqt, on);
+}
+
+SHOWCQT_PUBLIC const double *showcqt_get_stage_times(ShowCQT *cqt)
+{
+    return api->get_stage_times(cqt);
+}
+
+SHOWCQT_PUBLIC const double *showcqt_get_stats(ShowCQT *cqt)
+{
+    return api->get_stats(cqt);
+}
+
+SHOWCQT_PUBLIC void showcqt_reset_stats(ShowCQT *cqt)
+{
+    api->reset_stats(cqt);
+}
+
+SHOWCQT_PUBLIC void showcqt_set_skip_static(ShowCQT *cqt, float silence)
+{
+    api->set_skip_static(cqt, silence);
+}
+
+SHOWCQT_PUBLIC void showcqt_set_smoothing(ShowCQT *cqt, float attack, float decay)
+{
+    api->set_smoothing(cqt, attack, decay);
+}
+
+SHOWCQT_PUBLIC void showcqt_set_peak(ShowCQT *cqt, int hold, float fall)
+{
+    api->set_peak(cqt, hold, fall);
+}
+
+SHOWCQT_PUBLIC int showcqt_render_frame_delta(ShowCQT *cqt, int y1, uint8_t alpha, uint32_t *dst, int stride,
+                                              int *rects, int max_rects)
+{
+    return api->render_frame_delta(cqt, y1, alpha, dst, stride, rects, max_rects);
+}
+
+SHOWCQT_PUBLIC void showcqt_delta_invalidate(ShowCQT *cqt)
+{
+    api->delta_invalidate(cqt);
+}
+
+SHOWCQT_PUBLIC float *showcqt_get_input_array(ShowCQT *cqt, int index)
+{
+    return api->get_input_array(cqt, index);
+}
+
+SHOWCQT_PUBLIC int showcqt_push_samples(ShowCQT *cqt, const float *src0, const float *src1, int n, int stride)
+{
+    return api->push_samples(cqt, src0, src1, n, stride);
+}
+
+SHOWCQT_PUBLIC int showcqt_get_input_pos(ShowCQT *cqt)
+{
+    return api->get_input_pos(cqt);
+}
+
+SHOWCQT_PUBLIC int showcqt_get_input_dec(ShowCQT *cqt)
+{
+    return api->get_input_dec(cqt);
+}
+
+SHOWCQT_PUBLIC int showcqt_detect_silence(ShowCQT *cqt, float threshold)
+{
+    return api->detect_silence(cqt, threshold);
+}
+
+SHOWCQT_PUBLIC int showcqt_calc(ShowCQT *cqt)
+{
+    return api->calc(cqt);
+}
+
+SHOWCQT_PUBLIC void showcqt_calc_batch(ShowCQT *cqt, const float *src0, const float *src1, int n, int hop, float *dst)
+{
+    api->calc_batch(cqt, src0, src1, n, hop, (ColorF *) dst);
+}
+
+SHOWCQT_PUBLIC void showcqt_load_color(ShowCQT *cqt, const float *src)
+{
+    api->load_color(cqt, (const ColorF *) src);
+}
+
+SHOWCQT_PUBLIC float *showcqt_get_color_array(ShowCQT *cqt)
+{
+    return (float *) api->get_color_array(cqt);
+}
+
+SHOWCQT_PUBLIC uint32_t *showcqt_get_output_array(ShowCQT *cqt)
+{
+    return api->get_output_array(cqt);
+}
+
+SHOWCQT_PUBLIC void showcqt_render_line_alpha(ShowCQT *cqt, int y, uint8_t alpha)
+{
+    api->render_line_alpha(cqt, y, alpha);
+}
+
+SHOWCQT_PUBLIC void showcqt_render_line_opaque(ShowCQT *cqt, int y)
+{
+    api->render_line_opaque(cqt, y);
+}
+
+SHOWCQT_PUBLIC void showcqt_render_frame(ShowCQT *cqt, int y0, int y1, uint8_t alpha, uint32_t *dst, int stride)
+{
+    api->render_frame(cqt, y0, y1, alpha, dst, stride);
+}
+
+SHOWCQT_PUBLIC void showcqt_render_sono(ShowCQT *cqt, int order, uint8_t alpha, uint32_t *dst, int stride)
+{
+    api->render_sono(cqt, order, alpha, dst, stride);
+}
+
+SHOWCQT_PUBLIC void showcqt_render_frame_format(ShowCQT *cqt, int y0, int y1, uint8_t alpha, int format,
+                                                void *dst, int stride, void *dst_u, void *dst_v, int stride_c)
+{
+    api->render_frame_format(cqt, y0, y1, alpha, format, dst, stride, dst_u, dst_v, stride_c);
+}
+
+SHOWCQT_PUBLIC void showcqt_render_sono_format(ShowCQT *cqt, int order, uint8_t alpha, int format,
+                                               void *dst, int stride, void *dst_u, void *dst_v, int stride_c)
+{
+    api->render_sono_format(cqt, order, alpha, format, dst, stride, dst_u, dst_v, stride_c);
+}
+
+SHOWCQT_PUBLIC uint32_t *showcqt_get_sono_array(ShowCQT *cqt)
+{
+    return api->get_sono_array(cqt);
+}
+
+SHOWCQT_PUBLIC int showcqt_get_sono_head(ShowCQT *cqt)
+{
+    return api->get_sono_head(cqt);
+}
+
+SHOWCQT_PUBLIC void showcqt_set_volume(ShowCQT *cqt, float bar_v, float sono_v)
+{
+    api->set_volume(cqt, bar_v, sono_v);
+}
+
+SHOWCQT_PUBLIC void showcqt_set_height(ShowCQT *cqt, int height)
+{
+    api->set_height(cqt, height);
+}
+
+SHOWCQT_PUBLIC void showcqt_set_palette(ShowCQT *cqt, float r, float g, float b)
+{
+    api->set_palette(cqt, r, g, b);
+}
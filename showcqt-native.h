@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2020 Muhammad Faiz <mfcc64@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* Native x86-64 C API of libshowcqt, the same engine as showcqt.wasm.
+ * Functions mirror the wasm exports used by showcqt-main.mjs, see Readme.md. */
+
+#ifndef SHOWCQT_NATIVE_H_INCLUDED
+#define SHOWCQT_NATIVE_H_INCLUDED 1
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ShowCQT ShowCQT;
+
+/* showcqt_init() flags */
+#define SHOWCQT_MONO 1
+#define SHOWCQT_MULTIRES 2
+#define SHOWCQT_COMPACT 4
+#define SHOWCQT_DECIMATE 8
+
+/* showcqt_render_frame_format() and showcqt_render_sono_format() pixel formats */
+#define SHOWCQT_FORMAT_RGBA 0
+#define SHOWCQT_FORMAT_BGRA 1
+#define SHOWCQT_FORMAT_RGB565 2
+#define SHOWCQT_FORMAT_I420 3
+#define SHOWCQT_FORMAT_NV12 4
+
+/* instruction set of the engine */
+#define SHOWCQT_ISA_AUTO 0
+#define SHOWCQT_ISA_SCALAR 1
+#define SHOWCQT_ISA_AVX2 2
+#define SHOWCQT_ISA_AVX512 3
+
+/* Select the engine before the first showcqt_create(), by default the best one supported by the cpu.
+ * Returns the selected isa, or 0 if the cpu lacks it or contexts of another isa are alive. */
+int showcqt_set_isa(int isa);
+int showcqt_get_isa(void);
+const char *showcqt_isa_name(int isa);
+
+/* Contexts may be used from different threads, each context by one thread at a time. */
+ShowCQT *showcqt_create(void);
+void showcqt_destroy(ShowCQT *cqt);
+
+/* Returns fft_size, or 0 on invalid args. The tables of the last 4 configurations no context uses
+ * are kept, an init with one of them reuses them without building or copying. */
+int showcqt_init(ShowCQT *cqt, int rate, int width, int height, float bar_v, float sono_v, int super, int flags);
+int showcqt_init_import(ShowCQT *cqt, int rate, int width, int height, float bar_v, float sono_v, int super,
+                        int flags, const void *blob, int size);
+int showcqt_kernel_export_size(ShowCQT *cqt);
+int showcqt_kernel_export(ShowCQT *cqt, void *blob);
+int showcqt_init_sono(ShowCQT *cqt, int lines);
+
+/* frequency range of the bins, kept across showcqt_init(), (0, 0) is the default E0 to E10.
+ * Returns the new fft_size, 1 before showcqt_init(), or 0 on an invalid range. */
+int showcqt_set_range(ShowCQT *cqt, double fmin, double fmax);
+
+/* stages of showcqt_get_stage_times() */
+#define SHOWCQT_STAGE_INPUT 0
+#define SHOWCQT_STAGE_FFT 1
+#define SHOWCQT_STAGE_KERNEL 2
+#define SHOWCQT_STAGE_FINISH 3
+#define SHOWCQT_STAGE_PRERENDER 4
+#define SHOWCQT_STAGE_COUNT 5
+
+/* Per stage timing of showcqt_calc() and of the prerender done by the first render after it,
+ * off by default. showcqt_set_timing() clears the times, the array holds the ms spent in each stage. */
+void showcqt_set_timing(ShowCQT *cqt, int on);
+const double *showcqt_get_stage_times(ShowCQT *cqt);
+
+/* counters of showcqt_get_stats() */
+#define SHOWCQT_STAT_CALC_CALLS 0
+#define SHOWCQT_STAT_CALC_TIME 1
+#define SHOWCQT_STAT_CALC_MAX 2
+#define SHOWCQT_STAT_RENDER_CALLS 3
+#define SHOWCQT_STAT_RENDER_TIME 4
+#define SHOWCQT_STAT_RENDER_MAX 5
+#define SHOWCQT_STAT_KERNEL_TAPS 6
+#define SHOWCQT_STAT_BINS_SKIPPED 7
+#define SHOWCQT_STAT_TRANSPARENT_ROWS 8
+#define SHOWCQT_STAT_PRERENDERS 9
+#define SHOWCQT_STAT_COUNT 10
+
+/* Counters and ms of the calc and render calls since showcqt_create() or showcqt_reset_stats(),
+ * see STAT_* in showcqt.h. Only libshowcqt-stats.so of make native-stats keeps them, otherwise NULL. */
+const double *showcqt_get_stats(ShowCQT *cqt);
+void showcqt_reset_stats(ShowCQT *cqt);
+
+/* input[0] and input[1], fft_size samples each, reallocated by showcqt_init() and showcqt_set_range() */
+float *showcqt_get_input_array(ShowCQT *cqt, int index);
+int showcqt_push_samples(ShowCQT *cqt, const float *src0, const float *src1, int n, int stride);
+int showcqt_get_input_pos(ShowCQT *cqt);
+
+/* SHOWCQT_DECIMATE accepts rates up to 8 * 100000 and decimates them in showcqt_push_samples() to
+ * rate / showcqt_get_input_dec(), 44100 Hz or more. The ring, showcqt_calc_batch() spans and the bins
+ * are at that rate. Returns 1 without decimation. */
+int showcqt_get_input_dec(ShowCQT *cqt);
+int showcqt_detect_silence(ShowCQT *cqt, float threshold);
+
+/* returns 1 if the previous frame was reused, see showcqt_set_skip_static() */
+int showcqt_calc(ShowCQT *cqt);
+
+/* Off (silence < 0) by default. When on, showcqt_calc() reuses the previous frame without computing
+ * if the input and its position did not change, or if every sample pair is silent (l*l + r*r <= silence)
+ * as it was at the previous call. The rows rendered last may then be kept, renders are cheap too. */
+void showcqt_set_skip_static(ShowCQT *cqt, float silence);
+
+/* Applied by showcqt_calc() to the colors of each bin, off by default. Smoothing moves colors and heights
+ * from the previous frame by attack of the change when they rise, by decay when they fall (1 is off).
+ * Peak markers (fall < 0 is off) rise with their bar, stay hold frames, then fall by fall bar heights
+ * per frame, and are drawn one row high in the full color of the bin. Neither lets frames be skipped. */
+void showcqt_set_smoothing(ShowCQT *cqt, float attack, float decay);
+void showcqt_set_peak(ShowCQT *cqt, int hold, float fall);
+
+/* n frames from the spans src0 and src1, frame k ends at src[k*hop + fft_size - 1].
+ * dst receives n * width colors in the layout of showcqt_get_color_array(). */
+void showcqt_calc_batch(ShowCQT *cqt, const float *src0, const float *src1, int n, int hop, float *dst);
+void showcqt_load_color(ShowCQT *cqt, const float *src);
+
+/* interleaved r, g, b, h of width bins, valid after showcqt_calc() and before rendering */
+float *showcqt_get_color_array(ShowCQT *cqt);
+
+/* rgba pixels, little endian 0xAABBGGRR */
+uint32_t *showcqt_get_output_array(ShowCQT *cqt);
+void showcqt_render_line_alpha(ShowCQT *cqt, int y, uint8_t alpha);
+void showcqt_render_line_opaque(ShowCQT *cqt, int y);
+void showcqt_render_frame(ShowCQT *cqt, int y0, int y1, uint8_t alpha, uint32_t *dst, int stride);
+
+/* Rows 0 .. y1-1 into a persistent dst that holds the previous call's frame (same dst, stride, y1, alpha).
+ * Only columns that changed are redrawn, their areas go to rects as x, y, w, h (merged into the last one
+ * past max_rects) for partial uploads. Returns the count, 0 if nothing changed. showcqt_render_frame()
+ * or showcqt_render_frame_format() into dst, showcqt_init() or set_height make the next call redraw all. */
+int showcqt_render_frame_delta(ShowCQT *cqt, int y1, uint8_t alpha, uint32_t *dst, int stride, int *rects, int max_rects);
+/* The next showcqt_render_frame_delta() redraws all, e.g. after the caller drew into or cleared dst. */
+void showcqt_delta_invalidate(ShowCQT *cqt);
+void showcqt_render_sono(ShowCQT *cqt, int order, uint8_t alpha, uint32_t *dst, int stride);
+uint32_t *showcqt_get_sono_array(ShowCQT *cqt);
+
+/* The same rows in another pixel format, strides are in bytes. Packed formats (bgra, 16 bit rgb565)
+ * only use dst. 4:2:0 formats (BT.601 limited range) render row pairs from an even y0: luma to dst,
+ * chroma row (y - y0) / 2 to dst_u and dst_v, or interleaved to dst_u for nv12. */
+void showcqt_render_frame_format(ShowCQT *cqt, int y0, int y1, uint8_t alpha, int format,
+                                 void *dst, int stride, void *dst_u, void *dst_v, int stride_c);
+void showcqt_render_sono_format(ShowCQT *cqt, int order, uint8_t alpha, int format,
+                                void *dst, int stride, void *dst_u, void *dst_v, int stride_c);
+int showcqt_get_sono_head(ShowCQT *cqt);
+
+void showcqt_set_volume(ShowCQT *cqt, float bar_v, float sono_v);
+void showcqt_set_height(ShowCQT *cqt, int height);
+void showcqt_set_palette(ShowCQT *cqt, float r, float g, float b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
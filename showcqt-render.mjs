@@ -0,0 +1,303 @@
+#!/usr/bin/env node
+/*
+ * Copyright (c) 2020 Muhammad Faiz <mfcc64@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* https://github.com/mfcc64/showcqt-js */
+/* Offline renderer, audio file to raw RGBA frames on stdout. Frames are rendered by a pool of
+ * worker_threads, each one with its own ShowCQT instance, and written in order. Each frame is
+ * bars on top and sonogram below, like ffmpeg showcqt. */
+
+import {isMainThread, parentPort, workerData, Worker} from "node:worker_threads";
+import ShowCQT from "./showcqt-main.mjs";
+
+const CHUNK_FRAMES = 8;
+
+const usage = `usage: showcqt-render [options] input.wav|input.raw|- > frames.rgba
+  -s, --size WxH         frame size (default 1920x1080)
+  -r, --fps N            frame rate (default 30)
+      --bar-height N     rows of bars, the rest is sonogram (default height / 2)
+      --bar-v N          bar height, 1 to 100 (default 15)
+      --sono-v N         sonogram brightness, 1 to 100 (default 25)
+      --supersampling    transform at twice the width
+      --multires         multi-resolution kernel, see Readme.md
+  -j, --threads N        worker threads, 0 renders on the main thread (default cpu count)
+      --format FMT       raw input: f32le or s16le (default: WAV header)
+      --rate N           raw input sample rate (default 44100)
+      --channels N       raw input channels (default 2)
+
+example:
+  showcqt-render -s 1280x720 -r 60 in.wav | ffmpeg -f rawvideo -pix_fmt rgba -s 1280x720 -r 60 -i - -i in.wav out.mp4`;
+
+// the window of frame f holds the fft_size samples up to its timestamp, zero outside the audio
+function fill_inputs(cqt, opt, audio, f) {
+    var end = Math.round(f * opt.rate / opt.fps);
+    var start = end - cqt.fft_size;
+    for (var c = 0; c < 2; c++) {
+        var dst = cqt.inputs[c], src = audio[c];
+        var x0 = Math.max(0, -start), x1 = Math.max(x0, Math.min(cqt.fft_size, src.length - start));
+        dst.fill(0, 0, x0);
+        dst.set(src.subarray(start + x0, start + x1), x0);
+        dst.fill(0, x1);
+    }
+}
+
+async function create_renderer(opt, blob) {
+    if (blob)
+        ShowCQT.import_kernel(blob);
+    var cqt = await ShowCQT.instantiate();
+    // one sonogram line, the history is kept by the main thread
+    cqt.init(opt.rate, opt.width, opt.bar_height - 1, opt.bar_v, opt.sono_v, opt.supersampling, opt.bar_height, 1, opt.flags);
+    return cqt;
+}
+
+// frames [f0, f1) into out, each one is bar_height rows of bars followed by its sonogram line
+function render_frames(cqt, opt, audio, f0, f1, out) {
+    var size = 4 * opt.width * (opt.bar_height + 1);
+    for (var f = f0; f < f1; f++) {
+        fill_inputs(cqt, opt, audio, f);
+        cqt.calc();
+        cqt.render_frame(0, opt.bar_height, 255);
+        out.set(cqt.frame, (f - f0) * size);
+        out.set(cqt.sono, (f - f0) * size + 4 * opt.width * opt.bar_height);
+    }
+}
+
+if (!isMainThread) {
+    let {opt, audio, blob} = workerData;
+    let cqt = await create_renderer(opt, blob);
+    parentPort.on("message", function({id, f0, f1}) {
+        var out = new Uint8Array(4 * opt.width * (opt.bar_height + 1) * (f1 - f0));
+        render_frames(cqt, opt, audio, f0, f1, out);
+        parentPort.postMessage({id, buffer: out.buffer}, [out.buffer]);
+    });
+} else {
+    // the reader, e.g. ffmpeg, has quit
+    process.stdout.on("error", e => process.exit(e.code == "EPIPE" ? 0 : 1));
+    try {
+        await main();
+    } catch (e) {
+        console.error(`showcqt-render: ${e.message}`);
+        process.exitCode = 1;
+    }
+}
+
+async function main() {
+    var {parseArgs} = await import("node:util");
+    var {availableParallelism, cpus} = await import("node:os");
+    var {values, positionals} = parseArgs({
+        allowPositionals: true,
+        options: {
+            "size":             {type: "string", short: "s", default: "1920x1080"},
+            "fps":              {type: "string", short: "r", default: "30"},
+            "bar-height":       {type: "string"},
+            "bar-v":            {type: "string", default: "15"},
+            "sono-v":           {type: "string", default: "25"},
+            "supersampling":    {type: "boolean", default: false},
+            "multires":         {type: "boolean", default: false},
+            "threads":          {type: "string", short: "j"},
+            "format":           {type: "string"},
+            "rate":             {type: "string", default: "44100"},
+            "channels":         {type: "string", default: "2"},
+            "help":             {type: "boolean", short: "h", default: false}
+        }
+    });
+
+    if (values.help || positionals.length != 1) {
+        console.error(usage);
+        process.exitCode = values.help ? 0 : 1;
+        return;
+    }
+
+    var [width, height] = values.size.split("x").map(Number);
+    var opt = {
+        width, height,
+        fps: Number(values.fps),
+        bar_height: values["bar-height"] !== undefined ? Number(values["bar-height"]) : Math.floor(height / 2),
+        bar_v: Number(values["bar-v"]),
+        sono_v: Number(values["sono-v"]),
+        supersampling: values.supersampling,
+        flags: values.multires ? ShowCQT.MULTIRES : 0
+    };
+    if (!(width > 0 && height > 0 && opt.bar_height > 0 && opt.bar_height <= height && opt.fps > 0))
+        throw new Error("invalid size, bar height or frame rate");
+
+    var {rate, audio} = decode(await read_input(positionals[0]), values);
+    opt.rate = rate;
+
+    var frames = Math.ceil(audio[0].length * opt.fps / rate);
+    var threads = values.threads !== undefined ? Number(values.threads) : (availableParallelism ? availableParallelism() : cpus().length);
+
+    // also validates the options, and its kernel saves the workers from computing their own
+    var cqt = await create_renderer(opt);
+    var emit = create_writer(opt);
+
+    if (threads > 0) {
+        await render_workers(opt, audio, cqt.export_kernel(), frames, threads, emit);
+    } else {
+        var out = new Uint8Array(4 * width * (opt.bar_height + 1) * CHUNK_FRAMES);
+        for (var f = 0; f < frames; f += CHUNK_FRAMES) {
+            var f1 = Math.min(frames, f + CHUNK_FRAMES);
+            render_frames(cqt, opt, audio, f, f1, out);
+            await emit(out, f1 - f);
+        }
+    }
+}
+
+async function render_workers(opt, audio, blob, frames, threads, emit) {
+    var chunks = Math.ceil(frames / CHUNK_FRAMES);
+    var limit = 2 * threads;
+    var next = 0, done = 0;
+    var results = new Map(), idle = [], workers = [];
+    var wake = null, error = null;
+
+    var dispatch = function(worker) {
+        if (next < chunks && next - done < limit) {
+            var f0 = next * CHUNK_FRAMES;
+            worker.postMessage({id: next++, f0, f1: Math.min(frames, f0 + CHUNK_FRAMES)});
+        } else if (!idle.includes(worker)) {
+            idle.push(worker);
+        }
+    };
+
+    for (var k = 0; k < threads; k++) {
+        let worker = new Worker(new URL(import.meta.url), {workerData: {opt, audio, blob}});
+        worker.on("message", function({id, buffer}) {
+            results.set(id, new Uint8Array(buffer));
+            dispatch(worker);
+            wake?.();
+        });
+        worker.on("error", function(e) {
+            error = e;
+            wake?.();
+        });
+        workers.push(worker);
+    }
+    for (var k = 0; k < 2; k++)
+        workers.forEach(dispatch);
+
+    try {
+        for (; done < chunks; done++) {
+            while (!results.has(done) && !error)
+                await new Promise(resolve => wake = resolve);
+            if (error)
+                throw error;
+            var out = results.get(done);
+            results.delete(done);
+            await emit(out, Math.min(frames - done * CHUNK_FRAMES, CHUNK_FRAMES));
+            for (var n = idle.length; n > 0 && next < chunks; n--)
+                dispatch(idle.shift());
+        }
+    } finally {
+        await Promise.all(workers.map(w => w.terminate()));
+    }
+}
+
+// Writes frames rendered by render_frames() to stdout, adding the sonogram history below the bars.
+function create_writer(opt) {
+    var row = 4 * opt.width;
+    var sono_rows = opt.height - opt.bar_height;
+    // history twice, the newest sono_rows lines are always contiguous from row head
+    var sono = new Uint8Array(2 * row * sono_rows);
+    var head = 0;
+
+    for (var k = 3; k < sono.length; k += 4)
+        sono[k] = 255;
+
+    return async function(buf, count) {
+        var size = row * (opt.bar_height + 1);
+        for (var k = 0; k < count; k++) {
+            var src = buf.subarray(k * size, (k + 1) * size);
+            var frame = Buffer.allocUnsafe(row * opt.height);
+            frame.set(src.subarray(0, row * opt.bar_height));
+            if (sono_rows) {
+                head = (head + sono_rows - 1) % sono_rows;
+                sono.set(src.subarray(row * opt.bar_height), row * head);
+                sono.set(src.subarray(row * opt.bar_height), row * (head + sono_rows));
+                frame.set(sono.subarray(row * head, row * (head + sono_rows)), row * opt.bar_height);
+            }
+            if (!process.stdout.write(frame))
+                await new Promise(resolve => process.stdout.once("drain", resolve));
+        }
+    };
+}
+
+async function read_input(path) {
+    if (path != "-")
+        return (await import("node:fs")).readFileSync(path);
+    var chunks = [];
+    for await (var chunk of process.stdin)
+        chunks.push(chunk);
+    return Buffer.concat(chunks);
+}
+
+// First two channels as Float32Arrays on a SharedArrayBuffer, mono is copied to both.
+function decode(buf, values) {
+    var format, channels, rate, data;
+    if (buf.length >= 12 && buf.toString("latin1", 0, 4) == "RIFF" && buf.toString("latin1", 8, 12) == "WAVE") {
+        for (var p = 12; p + 8 <= buf.length;) {
+            var id = buf.toString("latin1", p, p + 4), size = buf.readUInt32LE(p + 4);
+            if (id == "fmt ") {
+                var tag = buf.readUInt16LE(p + 8), bits = buf.readUInt16LE(p + 22);
+                // WAVE_FORMAT_EXTENSIBLE, the sub format guid starts with the format tag
+                if (tag == 0xFFFE)
+                    tag = buf.readUInt16LE(p + 32);
+                channels = buf.readUInt16LE(p + 10);
+                rate = buf.readUInt32LE(p + 12);
+                format = {"1,8": "u8", "1,16": "s16le", "1,24": "s24le", "1,32": "s32le", "3,32": "f32le", "3,64": "f64le"}[tag + "," + bits];
+                if (!format)
+                    throw new Error(`unsupported WAV format ${tag}, ${bits} bits`);
+            } else if (id == "data") {
+                // streamed WAV files may have an unknown data size
+                data = buf.subarray(p + 8, size && size != 0xFFFFFFFF ? Math.min(buf.length, p + 8 + size) : buf.length);
+                break;
+            }
+            p += 8 + size + (size & 1);
+        }
+        if (!format || !data)
+            throw new Error("invalid WAV file");
+    } else {
+        format = values.format;
+        if (format != "f32le" && format != "s16le")
+            throw new Error("input is not a WAV file, use --format f32le or s16le for raw PCM");
+        channels = Number(values.channels);
+        rate = Number(values.rate);
+        data = buf;
+    }
+
+    var bytes = {u8: 1, s16le: 2, s24le: 3, s32le: 4, f32le: 4, f64le: 8}[format];
+    var read = {
+        u8:     p => (data[p] - 128) / 128,
+        s16le:  p => data.readInt16LE(p) / 32768,
+        s24le:  p => data.readIntLE(p, 3) / 8388608,
+        s32le:  p => data.readInt32LE(p) / 2147483648,
+        f32le:  p => data.readFloatLE(p),
+        f64le:  p => data.readDoubleLE(p)
+    }[format];
+
+    if (!(channels > 0 && rate > 0))
+        throw new Error("invalid channels or sample rate");
+
+    var length = Math.floor(data.length / (bytes * channels));
+    var audio = [0, 1].map(() => new Float32Array(new SharedArrayBuffer(4 * length)));
+    for (var c = 0; c < 2; c++) {
+        var ch = Math.min(c, channels - 1);
+        for (var x = 0, p = bytes * ch; x < length; x++, p += bytes * channels)
+            audio[c][x] = read(p);
+    }
+    return {rate, audio};
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2020 Muhammad Faiz <mfcc64@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* https://github.com/mfcc64/showcqt-js */
+/* calc() worker of showcqt-simd-mt.wasm, spawned by ShowCQT.instantiate({threads}) */
+
+let run = function({module, memory, index, stack_top}) {
+    var env = {
+        cos: Math.cos,
+        sin: Math.sin,
+        log: Math.log,
+        exp: Math.exp,
+        clock_ms: () => performance.now(),
+        memory,
+        memory_expand: function() {
+            throw new Error("ShowCQT worker: memory_expand is not allowed");
+        }
+    };
+
+    var exports = new WebAssembly.Instance(module, {env}).exports;
+    exports.__stack_pointer.value = stack_top;
+    // never returns, the worker is parked in memory.atomic.wait between frames
+    exports.worker_run(index);
+};
+
+if (globalThis.WorkerGlobalScope)
+    self.onmessage = e => run(e.data);
+else
+    (await import("node:worker_threads")).parentPort.once("message", run);
@@ -22,43 +22,158 @@
 #include <stdint.h>
 #include "showcqt.h"
 
-static DECLARE_ALIGNED(1024) ShowCQT cqt;
+static MemBlock *mem_list;
+static ShowCQTTables *tables_list;
 
-WASM_EXPORT float *get_input_array(int index)
+/* first-fit allocator on top of memory_expand, blocks are kept in address order */
+static void *mem_alloc(int size)
 {
-    return cqt.input[!!index];
+    MemBlock *b, *last = 0;
+    size = (size + 15) & ~15;
+
+    for (b = mem_list; b; last = b, b = b->next) {
+        if (b->used || b->size < size)
+            continue;
+        if (b->size >= size + 2 * (int) sizeof(MemBlock)) {
+            MemBlock *r = (MemBlock *)((uint8_t *)(b + 1) + size);
+            r->next = b->next;
+            r->size = b->size - size - sizeof(MemBlock);
+            r->used = 0;
+            b->next = r;
+            b->size = size;
+        }
+        b->used = 1;
+        return b + 1;
+    }
+
+    if (last && !last->used) {
+        memory_expand(size - last->size);
+        last->size = size;
+        last->used = 1;
+        return last + 1;
+    }
+
+    b = memory_expand(size + sizeof(MemBlock));
+    b->next = 0;
+    b->size = size;
+    b->used = 1;
+    if (last)
+        last->next = b;
+    else
+        mem_list = b;
+    return b + 1;
+}
+
+static void mem_free(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    ((MemBlock *) ptr - 1)->used = 0;
+    for (MemBlock *b = mem_list; b; b = b->next) {
+        while (!b->used && b->next && !b->next->used) {
+            b->size += sizeof(MemBlock) + b->next->size;
+            b->next = b->next->next;
+        }
+    }
+}
+
+WASM_EXPORT void *memory_alloc(int size)
+{
+    return mem_alloc(size);
+}
+
+WASM_EXPORT void memory_free(void *ptr)
+{
+    mem_free(ptr);
+}
+
+/* tables_list is in most recently used order, past TABLES_CACHE_SIZE unused tables the oldest are freed */
+static void tables_release(ShowCQTTables *t)
+{
+    if (!t || --t->refcount > 0)
+        return;
+
+    int unused = 0;
+    for (ShowCQTTables **p = &tables_list; *p; ) {
+        t = *p;
+        if (!t->refcount && ++unused > TABLES_CACHE_SIZE) {
+            *p = t->next;
+            mem_free(t);
+        } else {
+            p = &t->next;
+        }
+    }
+}
+
+static void release(ShowCQT *cqt)
+{
+    tables_release(cqt->tables);
+    mem_free(cqt->input[0]);
+    mem_free(cqt->sono_buf);
+    mem_free(cqt->last_input);
+    cqt->input[0] = cqt->input[1] = 0;
+    cqt->output = 0;
+    cqt->fft_buf = 0;
+    cqt->fft_tmp = 0;
+    cqt->color_buf = 0;
+    cqt->rcp_h_buf = 0;
+    cqt->smooth_buf = 0;
+    cqt->peak_buf = cqt->hold_buf = 0;
+    cqt->delta_buf = 0;
+    cqt->delta_peak = 0;
+    cqt->dec_coef = 0;
+    cqt->dec_hist[0] = cqt->dec_hist[1] = 0;
+    cqt->tables = 0;
+    cqt->sono_buf = 0;
+    cqt->sono_lines = 0;
+    cqt->sono_head = 0;
+    cqt->last_input = 0;
+    cqt->fft_size = 0;
+}
+
+WASM_EXPORT ShowCQT *create(void)
+{
+    ShowCQT *cqt = mem_alloc(sizeof(ShowCQT));
+    uint32_t *p = (uint32_t *) cqt;
+    for (int x = 0; x < (int)(sizeof(ShowCQT) >> 2); x++)
+        p[x] = 0;
+    cqt->palette = (ColorF){ 1, 1, 1, 1 };
+    cqt->skip_silence = -1;
+    cqt->fmin = DEFAULT_FMIN;
+    cqt->fmax = DEFAULT_FMAX;
+    return cqt;
+}
+
+WASM_EXPORT void destroy(ShowCQT *cqt)
+{
+    release(cqt);
+    mem_free(cqt);
 }
 
-WASM_EXPORT unsigned *get_output_array(void)
+WASM_EXPORT float *get_input_array(ShowCQT *cqt, int index)
 {
-    return cqt.output;
+    return cqt->input[!!index];
 }
 
-WASM_EXPORT ColorF *get_color_array(void)
+WASM_EXPORT unsigned *get_output_array(ShowCQT *cqt)
 {
-    return cqt.color_buf;
+    return cqt->output;
 }
 
-static unsigned revbin(unsigned x, int bits)
+WASM_EXPORT ColorF *get_color_array(ShowCQT *cqt)
 {
-    unsigned m = 0x55555555;
-    x = ((x & m) << 1) | ((x & ~m) >> 1);
-    m = 0x33333333;
-    x = ((x & m) << 2) | ((x & ~m) >> 2);
-    m = 0x0F0F0F0F;
-    x = ((x & m) << 4) | ((x & ~m) >> 4);
-    m = 0x00FF00FF;
-    x = ((x & m) << 8) | ((x & ~m) >> 8);
-    m = 0x0000FFFF;
-    x = ((x & m) << 16) | ((x & ~m) >> 16);
-    return (x >> (32 - bits)) & ((1 << bits) - 1);
+    return cqt->color_buf;
 }
 
-static void gen_perm_tbl(int bits)
+WASM_EXPORT unsigned *get_sono_array(ShowCQT *cqt)
 {
-    int n = 1 << bits;
-    for (int x = 0; x < n; x++)
-        cqt.perm_tbl[x] = revbin(x, bits);
+    return cqt->sono_buf;
+}
+
+WASM_EXPORT int get_sono_head(ShowCQT *cqt)
+{
+    return cqt->sono_head;
 }
 
 #define C_ADD(a, b) (Complex){ (a).re + (b).re, (a).im + (b).im }
@@ -122,602 +237,3010 @@ static ALWAYS_INLINE WASM_SIMD_FUNCTION Complex4 c4_load_uc_reverse(const Comple
 }
 #endif
 
-static WASM_SIMD_FUNCTION void gen_exp_tbl(int n)
+/* e^(-2*pi*i*m/n) is the product of the roots of m & ~63 and m & 63, so the n roots of a table
+ * take 2 * (n/64 + 64) calls of cos and sin instead of 2 * n, each is one rounding off */
+typedef struct RootTable {
+    double      hi[MAX_FFT_SIZE/64][2];
+    double      lo[64][2];
+} RootTable;
+
+static void roots_init(RootTable *r, int n)
+{
+    for (int x = 0; x < 64; x++)
+        r->lo[x][0] = cos(2 * M_PI * x / n), r->lo[x][1] = -sin(2 * M_PI * x / n);
+    for (int x = 0; x < n >> 6; x++)
+        r->hi[x][0] = cos(2 * M_PI * 64 * x / n), r->hi[x][1] = -sin(2 * M_PI * 64 * x / n);
+}
+
+static ALWAYS_INLINE Complex root(const RootTable *r, int m)
+{
+    const double *h = r->hi[m >> 6], *l = r->lo[m & 63];
+    return (Complex){ h[0] * l[0] - h[1] * l[1], h[0] * l[1] + h[1] * l[0] };
+}
+
+/* cos(y0 + k*dy) for k = 0, 1, ... by rotating (cos, sin) by dy, reseeded every 64 steps so the
+ * rounding drift stays near that of cos() */
+typedef struct CosRotor {
+    double      y0, dy, cd, sd, c, s;
+    int         k;
+} CosRotor;
+
+static void rotor_init(CosRotor *r, double y0, double dy)
+{
+    *r = (CosRotor){ y0, dy, cos(dy), sin(dy), 0, 0, 0 };
+}
+
+static ALWAYS_INLINE double rotor_next(CosRotor *r)
+{
+    if (!(r->k & 63)) {
+        r->c = cos(r->y0 + r->k * r->dy);
+        r->s = sin(r->y0 + r->k * r->dy);
+    }
+    double c = r->c;
+    r->c = c * r->cd - r->s * r->sd;
+    r->s = r->s * r->cd + c * r->sd;
+    r->k++;
+    return c;
+}
+
+/* Nuttall window of c = cos(y), with cos(2y) = 2c^2 - 1 and cos(3y) = (4c^2 - 3)c */
+static ALWAYS_INLINE double nuttall(double c)
+{
+    return 0.355768 + 0.487396 * c + 0.144232 * (2 * c * c - 1) + 0.012604 * (4 * c * c - 3) * c;
+}
+
+/* Four-step fft of n = n1 * n2 points, natural order in and out: n1 column ffts of n2 points over
+ * x[i1 + n1*i2], twiddled by e^(-2*pi*i*i1*k2/n) into y[i1*(n2+FFT_PAD) + k2], then n2 row ffts of n1 points
+ * over y into X[k2 + n2*k1]. The columns read the windowed input themselves, see fft_load(), y is fft_tmp
+ * and X is fft_buf, each fft runs on FFT_LANES columns or rows at once in a local buffer. The padding keeps
+ * the rows of y off the same cache sets. */
+#define FFT_LANE_SIZE 256   /* n1 of MAX_FFT_SIZE, n2 is at most n1/2 */
+#define FFT_PAD 4
+
+/* taps and phase padding of the multires half-band lowpass, see dec_coef */
+#define DEC_TAPS 7
+#define DEC_PAD 16
+
+/* a power of 4 if n1 stays within FFT_LANE_SIZE, so that only one of the ffts may end with radix 2 */
+static ALWAYS_INLINE int fft_n2(int n)
+{
+    int bits = __builtin_ctz(n), n2 = 1 << (2 * (bits >> 2));
+    return n / n2 > FFT_LANE_SIZE ? n / FFT_LANE_SIZE : n2;
+}
+
+/* the step twiddles in the order of fft_cols(), then the roots of the n2 and n1 point ffts, see fft_lanes() */
+static int fft_tbl_size(int n)
+{
+    return n + fft_n2(n) + n / fft_n2(n);
+}
+
+/* roots of the butterflies of an m point fft, the 4ns point ones at ns, 2ns and 3ns for ns = 4, 16, ..
+ * and the m point radix 2 ones at m/2 */
+static void gen_lane_roots(Complex *tbl, const RootTable *r, int n, int m)
 {
-    for (int k = 16; k <= n; k *= 4) {
+    for (int k = 16; k <= m; k *= 4) {
         int q = k/4;
-        double mul;
         for (int j = 1; j < 4; j++)
             for (int x = 0; x < q; x++)
-                mul = 2 * j * M_PI / k, cqt.exp_tbl[j*q+x] = (Complex){ cos(mul*x), -sin(mul*x) };
+                tbl[j*q+x] = root(r, j * x * (n / k));
 
-        if (k * 2 == n)
+        if (k * 2 == m)
             for (int x = 0; x < k; x++)
-                mul = M_PI / k, cqt.exp_tbl[k+x] = (Complex){ cos(mul*x), -sin(mul*x) };
+                tbl[k+x] = root(r, x * (n / m));
     }
+}
+
+#if WASM_SIMD
+typedef Complex4 FFTLane;
+#define FFT_LANES 4
+#define L_ADD(a, b) c4_add(a, b)
+#define L_SUB(a, b) c4_sub(a, b)
+#define L_AIM(a, b) c4_aim(a, b)
+#define L_SIM(a, b) c4_sim(a, b)
+#define L_MUL_ROOT(w, a) c4_mul((Complex4){ { (w).re, (w).re, (w).re, (w).re }, { (w).im, (w).im, (w).im, (w).im } }, a)
+
+/* 4 rows of y, 4 complex as 4 re and 4 im, and 4 points of X */
+static ALWAYS_INLINE WASM_SIMD_FUNCTION Complex4 fft_lane_load(const Complex *y)
+{
+    return c4_load_c(y, 0);
+}
+
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void fft_lane_store(Complex *x, Complex4 v)
+{
+    c4_store_c(x, v, 1);
+}
+
+/* 4x4 transpose of re and im */
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void f4_transpose(float32x4 *v)
+{
+    float32x4 l01 = __builtin_shufflevector(v[0], v[1], 0, 4, 1, 5);
+    float32x4 l23 = __builtin_shufflevector(v[2], v[3], 0, 4, 1, 5);
+    float32x4 h01 = __builtin_shufflevector(v[0], v[1], 2, 6, 3, 7);
+    float32x4 h23 = __builtin_shufflevector(v[2], v[3], 2, 6, 3, 7);
+    v[0] = __builtin_shufflevector(l01, l23, 0, 1, 4, 5);
+    v[1] = __builtin_shufflevector(l01, l23, 2, 3, 6, 7);
+    v[2] = __builtin_shufflevector(h01, h23, 0, 1, 4, 5);
+    v[3] = __builtin_shufflevector(h01, h23, 2, 3, 6, 7);
+}
+
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void c4_transpose(Complex4 *v)
+{
+    float32x4 re[4] = { v[0].re, v[1].re, v[2].re, v[3].re };
+    float32x4 im[4] = { v[0].im, v[1].im, v[2].im, v[3].im };
+    f4_transpose(re);
+    f4_transpose(im);
+    for (int m = 0; m < 4; m++)
+        v[m] = (Complex4){ re[m], im[m] };
+}
+#else
+typedef Complex FFTLane;
+#define FFT_LANES 1
+#define L_ADD(a, b) C_ADD(a, b)
+#define L_SUB(a, b) C_SUB(a, b)
+#define L_AIM(a, b) C_AIM(a, b)
+#define L_SIM(a, b) C_SIM(a, b)
+#define L_MUL_ROOT(w, a) C_MUL(w, a)
+
+static ALWAYS_INLINE Complex fft_lane_load(const Complex *y)
+{
+    return *y;
+}
+
+static ALWAYS_INLINE void fft_lane_store(Complex *x, Complex v)
+{
+    *x = v;
+}
+#endif
+
+static WASM_SIMD_FUNCTION void gen_exp_tbl(Complex *tbl, int n)
+{
+    RootTable r;
+    int n2 = fft_n2(n), n1 = n / n2;
+    roots_init(&r, n);
+    for (int i1 = 0; i1 < n1; i1++)
+        for (int k2 = 0; k2 < n2; k2++)
+            tbl[(i1 - i1 % FFT_LANES) * n2 + k2 * FFT_LANES + i1 % FFT_LANES] = root(&r, i1 * k2);
+    gen_lane_roots(tbl + n, &r, n, n2);
+    gen_lane_roots(tbl + n + n2, &r, n, n1);
 
 #if WASM_SIMD
-    for (int x = 4; x < n; x += 4) {
-        Complex4 v = c4_load_c(cqt.exp_tbl+x, 1);
-        c4_store_c(cqt.exp_tbl+x, v, 0);
+    for (int x = 0; x < n; x += 4) {
+        Complex4 v = c4_load_c(tbl+x, 1);
+        c4_store_c(tbl+x, v, 0);
     }
 #endif
 }
 
-static ALWAYS_INLINE void fft_butterfly(Complex *restrict v, unsigned n, unsigned q)
+/* Stockham autosort m point ffts of the lanes: the pass after ns = 1, 4, 16, .. reads a[j + r*m/4] for r < 4,
+ * twiddles them by the roots of the 4ns point butterflies at k = j % ns and writes their dft to
+ * b[4(j-k) + k + r*ns]. A radix 2 pass ends an m that is not a power of 4. fft_cols() and fft_rows() run the
+ * first pass on their loads and the last one on their stores. */
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void fft_dft4(const FFTLane *v, FFTLane *restrict d, int ns)
 {
-    const Complex *restrict e2 = cqt.exp_tbl + 2*q;
-    const Complex *restrict e3 = cqt.exp_tbl + 3*q;
-    const Complex *restrict e1 = cqt.exp_tbl + 1*q;
-    Complex v0, v1, v2, v3;
-    Complex a02, a13, s02, s13;
+    FFTLane a02 = L_ADD(v[0], v[2]), s02 = L_SUB(v[0], v[2]);
+    FFTLane a13 = L_ADD(v[1], v[3]), s13 = L_SUB(v[1], v[3]);
+    d[0] = L_ADD(a02, a13);
+    d[ns] = L_SIM(s02, s13);
+    d[2*ns] = L_SUB(a02, a13);
+    d[3*ns] = L_AIM(s02, s13);
+}
 
-    v0 = v[0];
-    v2 = v[q]; /* bit reversed */
-    v1 = v[2*q];
-    v3 = v[3*q];
-    a02 = C_ADD(v0, v2);
-    s02 = C_SUB(v0, v2);
-    a13 = C_ADD(v1, v3);
-    s13 = C_SUB(v1, v3);
-    v[0] = C_ADD(a02, a13);
-    v[q] = C_SIM(s02, s13);
-    v[2*q] = C_SUB(a02, a13);
-    v[3*q] = C_AIM(s02, s13);
+/* ns of the last pass, radix 4 if 4ns == m, else radix 2 */
+static ALWAYS_INLINE int fft_last_ns(int m)
+{
+    return 1 << ((__builtin_ctz(m) - 1) & ~1);
+}
 
-    for (int x = 1; x < q; x++) {
-        v0 = v[x];
-        v2 = C_MUL(e2[x], v[q+x]); /* bit reversed */
-        v1 = C_MUL(e1[x], v[2*q+x]);
-        v3 = C_MUL(e3[x], v[3*q+x]);
-        a02 = C_ADD(v0, v2);
-        s02 = C_SUB(v0, v2);
-        a13 = C_ADD(v1, v3);
-        s13 = C_SUB(v1, v3);
-        v[x] = C_ADD(a02, a13);
-        v[q+x] = C_SIM(s02, s13);
-        v[2*q+x] = C_SUB(a02, a13);
-        v[3*q+x] = C_AIM(s02, s13);
+/* the passes between the first and the last, from a and b, returns the one with the result */
+static ALWAYS_INLINE WASM_SIMD_FUNCTION FFTLane *fft_lanes(FFTLane *a, FFTLane *b, int m, const Complex *tbl)
+{
+    int q = m >> 2;
+    for (int ns = 4; 4 * ns < m; ns *= 4) {
+        for (int k = 0; k < ns; k++) {
+            Complex e1 = tbl[ns+k], e2 = tbl[2*ns+k], e3 = tbl[3*ns+k];
+            for (int j = k; j < q; j += ns) {
+                FFTLane v[4] = { a[j], L_MUL_ROOT(e1, a[q+j]), L_MUL_ROOT(e2, a[2*q+j]), L_MUL_ROOT(e3, a[3*q+j]) };
+                fft_dft4(v, b + 4*(j-k) + k, ns);
+            }
+        }
+        FFTLane *c = a;
+        a = b;
+        b = c;
     }
+    return a;
 }
 
-static ALWAYS_INLINE void fft_butterfly2(Complex *restrict v, unsigned n, unsigned h)
+/* butterfly j of the last pass, its outputs v[r] are points j + r*ns */
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void fft_lanes_last(const FFTLane *a, int m, int ns, int j, const Complex *tbl,
+                                                            FFTLane *v)
 {
-    const Complex *restrict e = cqt.exp_tbl + h;
-    Complex v0 = v[0], v1 = v[h];
+    if (2 * ns == m) {
+        FFTLane v1 = L_MUL_ROOT(tbl[ns+j], a[ns+j]);
+        v[0] = L_ADD(a[j], v1);
+        v[1] = L_SUB(a[j], v1);
+        return;
+    }
+    FFTLane t[4] = { a[j], L_MUL_ROOT(tbl[ns+j], a[ns+j]), L_MUL_ROOT(tbl[2*ns+j], a[2*ns+j]),
+                     L_MUL_ROOT(tbl[3*ns+j], a[3*ns+j]) };
+    fft_dft4(t, v, 1);
+}
 
-    v[0] = C_ADD(v0, v1);
-    v[h] = C_SUB(v0, v1);
+/* seconds of the window of freq, the longest is 0.33 at 0 Hz */
+static double kernel_tlen(double freq)
+{
+    return 384*0.33 / (384/0.17 + 0.33*freq/(1-0.17)) + 384*0.33 / (0.33*freq/0.17 + 384/(1-0.17));
+}
 
-    for (int x = 1; x < h; x++) {
-        v0 = v[x];
-        v1 = C_MUL(e[x], v[h+x]);
-        v[x] = C_ADD(v0, v1);
-        v[h+x] = C_SUB(v0, v1);
-    }
+/* the fft holds the window of fmin, the default range keeps the 0.33 seconds of the fixed range */
+static int fft_bits(int rate, double fmin)
+{
+    int bits = ceil(log(rate * (fmin > DEFAULT_FMIN ? kernel_tlen(fmin) : 0.33)) / M_LN2);
+    return bits < 12 ? 12 : bits;
 }
 
-#define FFT_CALC_FUNC(n, q)                                                     \
-static void fft_calc_ ## n(Complex *restrict v)                                 \
-{                                                                               \
-    fft_calc_ ## q(v);                                                          \
-    fft_calc_ ## q(q+v);                                                        \
-    fft_calc_ ## q(2*q+v);                                                      \
-    fft_calc_ ## q(3*q+v);                                                      \
-    fft_butterfly(v, n, q);                                                     \
+/* INIT_DECIMATE: the largest factor up to MAX_INPUT_DEC that divides rate and keeps rate / factor >= DEC_RATE */
+static int input_dec(int rate, int flags)
+{
+    int dec = flags & INIT_DECIMATE ? rate / DEC_RATE : 1;
+    for (dec = dec < 1 ? 1 : dec > MAX_INPUT_DEC ? MAX_INPUT_DEC : dec; rate % dec; dec--);
+    return dec;
 }
 
-#define FFT_CALC2_FUNC(n, h)                                                    \
-static void fft_calc_ ## n(Complex *restrict v)                                 \
-{                                                                               \
-    fft_calc_ ## h(v);                                                          \
-    fft_calc_ ## h(v+h);                                                        \
-    fft_butterfly2(v, n, h);                                                    \
+/* the tables are built for the internal rate, rate / cqt->input_dec */
+static int init_props(ShowCQT *cqt, int rate, int width, int height, float bar_v, float sono_v, int super, int flags)
+{
+    release(cqt);
+    if (height <= 0 || height > MAX_HEIGHT || width <= 0 || width > MAX_WIDTH)
+        return 0;
+
+    cqt->width = width;
+    cqt->height = height;
+    cqt->aligned_width = WASM_SIMD ? SIMD_WIDTH * ceil(width * (1.0 / SIMD_WIDTH)) : width;
+
+    cqt->bar_v = (bar_v > MAX_VOL) ? MAX_VOL : (bar_v > MIN_VOL) ? bar_v : MIN_VOL;
+    cqt->sono_v = (sono_v > MAX_VOL) ? MAX_VOL : (sono_v > MIN_VOL) ? sono_v : MIN_VOL;
+
+    cqt->input_dec = input_dec(rate, flags);
+    rate /= cqt->input_dec;
+    if (rate < 8000 || rate > 100000)
+        return 0;
+
+    int bits = fft_bits(rate, cqt->fmin);
+    if (bits > 20 || (1 << bits) > MAX_FFT_SIZE)
+        return 0;
+
+    cqt->attack_size = ceil(rate * 0.033);
+    cqt->t_size = cqt->width * (1 + !!super);
+    cqt->mono = !!(flags & INIT_MONO);
+    cqt->multires = !cqt->mono && (flags & INIT_MULTIRES);
+    cqt->compact = !!(flags & INIT_COMPACT);
+    cqt->input_pos = 0;
+    return bits;
 }
 
-#if !WASM_SIMD
-static void fft_calc_1024(Complex *restrict v)
+/* Complex fft sizes. fft0 computes bins from split up: the whole fft, the half size fft of mono
+ * or the short window of multires. fft1 computes bins below split from the decimated long window. */
+static int fft0_size(int fft_size, int mono, int multires)
 {
-    for (int k = 0; k < 1024; k += 4)
-        fft_butterfly(v+k, 4, 1);
-    for (int k = 0; k < 1024; k += 16)
-        fft_butterfly(v+k, 16, 4);
-    for (int k = 0; k < 1024; k += 64)
-        fft_butterfly(v+k, 64, 16);
-    for (int k = 0; k < 1024; k += 256)
-        fft_butterfly(v+k, 256, 64);
-    fft_butterfly(v, 1024, 256);
+    return fft_size >> (mono ? 1 : multires ? 2 : 0);
 }
 
-FFT_CALC_FUNC(4096, 1024)
-FFT_CALC_FUNC(16384, 4096)
+static int fft1_size(int fft_size, int multires, int dec_bits)
+{
+    return multires ? fft_size >> dec_bits : 0;
+}
 
-FFT_CALC2_FUNC(8192, 4096)
-FFT_CALC2_FUNC(32768, 16384)
-#else
+static ALWAYS_INLINE int tile_size(const KernelTile *tile)
+{
+    return tile->len * tile->bins;
+}
 
-static ALWAYS_INLINE WASM_SIMD_FUNCTION void fft_butterfly_simd(Complex *restrict v, unsigned n, unsigned q, int sh)
-{
-    const Complex *restrict e2 = cqt.exp_tbl + 2*q;
-    const Complex *restrict e3 = cqt.exp_tbl + 3*q;
-    const Complex *restrict e1 = cqt.exp_tbl + 1*q;
-    Complex4 v0, v1, v2, v3;
-    Complex4 a02, a13, s02, s13;
-
-    for (int x = 0; x < q; x += 4) {
-        v0 = c4_load_c(v+x, 0);
-        v2 = c4_mul(c4_load_c(e2+x, 0), c4_load_c(v+q+x, 0)); /* bit reversed */
-        v1 = c4_mul(c4_load_c(e1+x, 0), c4_load_c(v+2*q+x, 0));
-        v3 = c4_mul(c4_load_c(e3+x, 0), c4_load_c(v+3*q+x, 0));
-        a02 = c4_add(v0, v2);
-        s02 = c4_sub(v0, v2);
-        a13 = c4_add(v1, v3);
-        s13 = c4_sub(v1, v3);
-        c4_store_c(v+x, c4_add(a02, a13), sh);
-        c4_store_c(v+q+x, c4_sim(s02, s13), sh);
-        c4_store_c(v+2*q+x, c4_sub(a02, a13), sh);
-        c4_store_c(v+3*q+x, c4_aim(s02, s13), sh);
-    }
-}
-
-static ALWAYS_INLINE WASM_SIMD_FUNCTION void fft_butterfly2_simd(Complex *restrict v, unsigned n, unsigned h)
-{
-    const Complex *restrict e = cqt.exp_tbl + h;
-    Complex4 v0, v1;
-
-    for (int x = 0; x < h; x += 4) {
-        v0 = c4_load_c(v+x, 0);
-        v1 = c4_mul(c4_load_c(e+x, 0), c4_load_c(v+h+x, 0));
-        c4_store_c(v+x, c4_add(v0, v1), 1);
-        c4_store_c(v+h+x, c4_sub(v0, v1), 1);
-    }
-}
-
-static ALWAYS_INLINE WASM_SIMD_FUNCTION void fft_calc_16_0(Complex *restrict v)
-{
-    const Complex *restrict e2 = cqt.exp_tbl + 2*4;
-    const Complex *restrict e3 = cqt.exp_tbl + 3*4;
-    const Complex *restrict e1 = cqt.exp_tbl + 1*4;
-    Complex4 v0, v1, v2, v3;
-    Complex4 a02, a13, s02, s13;
-
-    /* butterfly 4 */ {
-        float32x4 *vf = (float32x4 *) v;
-        float32x4 r0145 = __builtin_shufflevector(vf[0], vf[2], 0, 2, 4, 6);
-        float32x4 i0145 = __builtin_shufflevector(vf[0], vf[2], 1, 3, 5, 7);
-        float32x4 r2367 = __builtin_shufflevector(vf[1], vf[3], 0, 2, 4, 6);
-        float32x4 i2367 = __builtin_shufflevector(vf[1], vf[3], 1, 3, 5, 7);
-        float32x4 r89cd = __builtin_shufflevector(vf[4], vf[6], 0, 2, 4, 6);
-        float32x4 i89cd = __builtin_shufflevector(vf[4], vf[6], 1, 3, 5, 7);
-        float32x4 rabef = __builtin_shufflevector(vf[5], vf[7], 0, 2, 4, 6);
-        float32x4 iabef = __builtin_shufflevector(vf[5], vf[7], 1, 3, 5, 7);
-
-        v0 = (Complex4){__builtin_shufflevector(r0145, r89cd, 0, 2, 4, 6), __builtin_shufflevector(i0145, i89cd, 0, 2, 4, 6)};
-        v2 = (Complex4){__builtin_shufflevector(r0145, r89cd, 1, 3, 5, 7), __builtin_shufflevector(i0145, i89cd, 1, 3, 5, 7)};
-        v1 = (Complex4){__builtin_shufflevector(r2367, rabef, 0, 2, 4, 6), __builtin_shufflevector(i2367, iabef, 0, 2, 4, 6)};
-        v3 = (Complex4){__builtin_shufflevector(r2367, rabef, 1, 3, 5, 7), __builtin_shufflevector(i2367, iabef, 1, 3, 5, 7)};
+#define ALIGN16(n) (((n) + 15) & ~15)
 
-        a02 = c4_add(v0, v2);
-        s02 = c4_sub(v0, v2);
-        a13 = c4_add(v1, v3);
-        s13 = c4_sub(v1, v3);
+/* Kaiser windowed lowpass of INIT_DECIMATE at the input rate, passband up to DEFAULT_FMAX and stopband
+ * from the internal rate minus DEFAULT_FMAX at about -96dB: what aliases into the bins is attenuated,
+ * the transition band only aliases above DEFAULT_FMAX. dec_taps() is a multiple of DEC_STEP. */
+#define DEC_ATTEN 96.0
+#define DEC_STEP 8
+#define DEC_BLOCK 1024
 
-        v0 = c4_add(a02, a13); // 0,4,8,c
-        v1 = c4_sim(s02, s13); // 1,5,9,d
-        v2 = c4_sub(a02, a13); // 2,6,a,e
-        v3 = c4_aim(s02, s13); // 3,7,b,f
+static int dec_taps(int rate, int dec)
+{
+    double dw = 2 * M_PI * (rate - 2 * DEFAULT_FMAX) / ((double) rate * dec);
+    int taps = ceil((DEC_ATTEN - 8) / (2.285 * dw)) + 1;
+    return (taps + DEC_STEP - 1) / DEC_STEP * DEC_STEP;
+}
 
-        float32x4 r0819 = __builtin_shufflevector(v0.re, v1.re, 0, 2, 4, 6);
-        float32x4 r4c5d = __builtin_shufflevector(v0.re, v1.re, 1, 3, 5, 7);
-        float32x4 i0819 = __builtin_shufflevector(v0.im, v1.im, 0, 2, 4, 6);
-        float32x4 i4c5d = __builtin_shufflevector(v0.im, v1.im, 1, 3, 5, 7);
-        float32x4 r2a3b = __builtin_shufflevector(v2.re, v3.re, 0, 2, 4, 6);
-        float32x4 r6e7f = __builtin_shufflevector(v2.re, v3.re, 1, 3, 5, 7);
-        float32x4 i2a3b = __builtin_shufflevector(v2.im, v3.im, 0, 2, 4, 6);
-        float32x4 i6e7f = __builtin_shufflevector(v2.im, v3.im, 1, 3, 5, 7);
+static double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+    for (int k = 1; term > 1e-12 * sum; k++) {
+        term *= (0.5 * x / k) * (0.5 * x / k);
+        sum += term;
+    }
+    return sum;
+}
 
-        v0.re = __builtin_shufflevector(r0819, r2a3b, 0, 2, 4, 6);
-        v1.re = __builtin_shufflevector(r0819, r2a3b, 1, 3, 5, 7);
-        v2.re = __builtin_shufflevector(r4c5d, r6e7f, 0, 2, 4, 6);
-        v3.re = __builtin_shufflevector(r4c5d, r6e7f, 1, 3, 5, 7);
-        v0.im = __builtin_shufflevector(i0819, i2a3b, 0, 2, 4, 6);
-        v1.im = __builtin_shufflevector(i0819, i2a3b, 1, 3, 5, 7);
-        v2.im = __builtin_shufflevector(i4c5d, i6e7f, 0, 2, 4, 6);
-        v3.im = __builtin_shufflevector(i4c5d, i6e7f, 1, 3, 5, 7);
+/* cutoff at the internal nyquist, normalized to a dc gain of 1 */
+static void gen_dec_coef(float *coef, int taps, int dec)
+{
+    double beta = 0.1102 * (DEC_ATTEN - 8.7), c = 0.5 * (taps - 1), sum = 0;
+    for (int k = 0; k < taps; k++) {
+        double x = k - c, r = x / c;
+        double h = x ? sin(M_PI * x / dec) / (M_PI * x) : 1.0 / dec;
+        coef[k] = h * bessel_i0(beta * sqrt(1 - r * r)) / bessel_i0(beta);
+        sum += coef[k];
     }
+    for (int k = 0; k < taps; k++)
+        coef[k] *= 1.0 / sum;
+}
+
+/* the copy of the ring compared by calc_reuse(), allocated while set_skip_static() is on */
+static void last_input_alloc(ShowCQT *cqt)
+{
+    mem_free(cqt->last_input);
+    cqt->last_input = cqt->skip_silence >= 0 && cqt->fft_size ? mem_alloc(2 * cqt->fft_size * sizeof(float)) : 0;
+    cqt->last_valid = 0;
+}
 
-    v2 = c4_mul(c4_load_c(e2, 0), v2); /* bit reversed */
-    v1 = c4_mul(c4_load_c(e1, 0), v1);
-    v3 = c4_mul(c4_load_c(e3, 0), v3);
-    a02 = c4_add(v0, v2);
-    s02 = c4_sub(v0, v2);
-    a13 = c4_add(v1, v3);
-    s13 = c4_sub(v1, v3);
-    c4_store_c(v, c4_add(a02, a13), 0);
-    c4_store_c(v+4, c4_sim(s02, s13), 0);
-    c4_store_c(v+2*4, c4_sub(a02, a13), 0);
-    c4_store_c(v+3*4, c4_aim(s02, s13), 0);
-}
-
-#define FFT_CALC_FUNC_SIMD(n, q, sh)                                            \
-static WASM_SIMD_FUNCTION void fft_calc_ ## n ## _ ## sh(Complex *restrict v)   \
-{                                                                               \
-    fft_calc_ ## q ## _0(v);                                                    \
-    fft_calc_ ## q ## _0(q+v);                                                  \
-    fft_calc_ ## q ## _0(2*q+v);                                                \
-    fft_calc_ ## q ## _0(3*q+v);                                                \
-    fft_butterfly_simd(v, n, q, sh);                                            \
+/* Complex entries of fft_buf: the output of the largest fft, in mono with the bins past nyquist of
+ * calc_rfft_split(), or the ping-pong of calc_input_dec() if that is more. The 128 spare entries cover
+ * the kernel loads rounded up to 4 bins. */
+static int fft_buf_size(const ShowCQT *cqt, int fft0, int fft1)
+{
+    const ShowCQTTables *t = cqt->tables;
+    int n = (fft0 > fft1 ? fft0 : fft1) + (cqt->mono ? t->rfft_ext : 0);
+
+    /* the first stage's phases, then the second stage's (len / 2 + DEC_TAPS + 1 at most) or the output */
+    if (t->dec_bits) {
+        int len = ((cqt->fft_size >> 1) + cqt->attack_size + 1) >> 1;
+        int y = len + 2 * (DEC_TAPS + 1) + 4 * DEC_PAD;
+        int dec = 2 * (len + 2 * DEC_PAD) + (y > fft1 ? y : fft1);
+        n = dec > n ? dec : n;
+    }
+    return n + 128;
 }
 
-#define FFT_CALC2_FUNC_SIMD(n, h)                                               \
-static WASM_SIMD_FUNCTION void fft_calc_ ## n(Complex *restrict v)              \
-{                                                                               \
-    fft_calc_ ## h ## _0(v);                                                    \
-    fft_calc_ ## h ## _0(v+h);                                                    \
-    fft_butterfly2_simd(v, n, h);                                               \
+/* The buffers of a context in one block sized by fft_size and t_size, zeroed (silent input).
+ * The ffts of mono and multires only need fft_buf and fft_tmp of their size. Mono keeps input[1],
+ * as push_samples() still writes both channels, the silence and skip_static checks compare both
+ * and the API hands out both arrays. */
+static void buffers_alloc(ShowCQT *cqt)
+{
+    const ShowCQTTables *t = cqt->tables;
+    int fft0 = fft0_size(cqt->fft_size, cqt->mono, cqt->multires);
+    int fft1 = fft1_size(cqt->fft_size, cqt->multires, t->dec_bits);
+    int colors = cqt->t_size > cqt->aligned_width ? cqt->t_size : cqt->aligned_width;
+    int input_size = ALIGN16((cqt->fft_size + 64) * sizeof(float));
+    int output_size = ALIGN16(cqt->aligned_width * sizeof(unsigned));
+    int fft_size = ALIGN16(fft_buf_size(cqt, fft0, fft1) * sizeof(Complex));
+    int tmp_size = ALIGN16(((fft0 > fft1 ? fft0 : fft1) + FFT_PAD * FFT_LANE_SIZE) * sizeof(Complex));
+    int color_size = ALIGN16(colors * sizeof(ColorF));
+    int rcp_size = ALIGN16(cqt->aligned_width * sizeof(float));
+    int smooth_size = ALIGN16(cqt->aligned_width * sizeof(ColorF));
+    int taps = cqt->input_dec > 1 ? dec_taps(t->rate, cqt->input_dec) : 0;
+    int coef_size = ALIGN16(taps * sizeof(float));
+    int hist_size = taps ? ALIGN16((taps + DEC_BLOCK) * sizeof(float)) : 0;
+    int size = 2 * input_size + output_size + fft_size + tmp_size + color_size + 4 * rcp_size + 2 * smooth_size +
+               coef_size + 2 * hist_size;
+    mem_free(cqt->input[0]);
+    uint8_t *p = mem_alloc(size);
+
+    for (int x = 0; x < size >> 2; x++)
+        ((uint32_t *) p)[x] = 0;
+    cqt->input[0] = (float *) p;
+    cqt->input[1] = (float *)(p += input_size);
+    cqt->output = (unsigned *)(p += input_size);
+    cqt->fft_buf = (Complex *)(p += output_size);
+    cqt->fft_tmp = (Complex *)(p += fft_size);
+    cqt->color_buf = (ColorF *)(p += tmp_size);
+    cqt->rcp_h_buf = (float *)(p += color_size);
+    cqt->peak_buf = (float *)(p += rcp_size);
+    cqt->hold_buf = (float *)(p += rcp_size);
+    cqt->smooth_buf = (ColorF *)(p += rcp_size);
+    cqt->delta_buf = (ColorF *)(p += smooth_size);
+    cqt->delta_peak = (float *)(p += smooth_size);
+    cqt->dec_coef = (float *)(p += rcp_size);
+    cqt->dec_hist[0] = (float *)(p += coef_size);
+    cqt->dec_hist[1] = (float *)(p += hist_size);
+    cqt->dec_taps = taps;
+    cqt->dec_fill = 0;
+    if (taps)
+        gen_dec_coef(cqt->dec_coef, taps, cqt->input_dec);
+    last_input_alloc(cqt);
 }
 
-static WASM_SIMD_FUNCTION void fft_calc_1024_0(Complex *restrict v)
+static int attach_tables(ShowCQT *cqt, ShowCQTTables *t)
 {
-    for (int k = 0; k < 1024; k += 16)
-        fft_calc_16_0(v+k);
-    for (int k = 0; k < 1024; k += 64)
-        fft_butterfly_simd(v+k, 64, 16, 0);
-    for (int k = 0; k < 1024; k += 256)
-        fft_butterfly_simd(v+k, 256, 64, 0);
-    fft_butterfly_simd(v, 1024, 256, 0);
-}
+    t->rfft_ext = 0;
+    for (int k = 0; t->mono && k < t->tile_count; k++) {
+        int ext = t->tiles[k].start + t->tiles[k].len - (t->fft_size >> 1);
+        if (t->tiles[k].len && ext > t->rfft_ext)
+            t->rfft_ext = ext < (t->fft_size >> 2) ? ext : (t->fft_size >> 2);
+    }
 
-FFT_CALC_FUNC_SIMD(4096, 1024, 0)
-FFT_CALC_FUNC_SIMD(16384, 4096, 0)
+    t->split_tile = t->split_offset = 0;
+    for (; t->split_tile < t->tile_count && t->tiles[t->split_tile].x < t->split; t->split_tile++)
+        t->split_offset += tile_size(&t->tiles[t->split_tile]);
+
+    t->refcount++;
+    cqt->tables = t;
+    cqt->fft_size = t->fft_size;
+    cqt->prerender = 0;
+    cqt->max_h = 0;
+    cqt->last_valid = 0;
+    cqt->delta_valid = 0;
+    buffers_alloc(cqt);
+    return cqt->fft_size;
+}
 
-FFT_CALC_FUNC_SIMD(4096, 1024, 1)
-FFT_CALC_FUNC_SIMD(16384, 4096, 1)
-
-FFT_CALC2_FUNC_SIMD(8192, 4096)
-FFT_CALC2_FUNC_SIMD(32768, 16384)
-
-#define fft_calc_4096 fft_calc_4096_1
-#define fft_calc_16384 fft_calc_16384_1
-#endif
-
-static void fft_calc(Complex *restrict v, int n)
-{
-    switch (n) {
-        case 4096: fft_calc_4096(v); break;
-        case 8192: fft_calc_8192(v); break;
-        case 16384: fft_calc_16384(v); break;
-        case 32768: fft_calc_32768(v); break;
+/* a hit moves to the front of tables_list */
+static ShowCQTTables *tables_find(const ShowCQT *cqt, int rate, int super)
+{
+    for (ShowCQTTables **p = &tables_list; *p; p = &(*p)->next) {
+        ShowCQTTables *t = *p;
+        if (t->rate == rate && t->width == cqt->width && t->super == !!super &&
+            t->mono == cqt->mono && t->multires == cqt->multires && t->compact == cqt->compact &&
+            t->fmin == cqt->fmin && t->fmax == cqt->fmax) {
+            *p = t->next;
+            t->next = tables_list;
+            tables_list = t;
+            return t;
+        }
     }
+    return 0;
 }
 
-WASM_EXPORT int init(int rate, int width, int height, float bar_v, float sono_v, int super)
+/* bytes of the kernel coefficients, the int16 ones of compact are padded to a multiple of 4 */
+static int kernel_bytes(int kernel_size, int compact)
 {
-    memory_expand(-1);
-    if (height <= 0 || height > MAX_HEIGHT || width <= 0 || width > MAX_WIDTH)
-        return 0;
+    return compact ? (kernel_size * (int) sizeof(int16_t) + 3) & ~3 : kernel_size * (int) sizeof(float);
+}
+
+/* the tables are allocated in one block with the struct, the kernel is 16-byte aligned */
+static ShowCQTTables *tables_alloc(const ShowCQT *cqt, int rate, int super, int bits, int kernel_size,
+                                   int tile_count, int split, int dec_bits)
+{
+    int fft_size = 1 << bits;
+    int fft0 = fft0_size(fft_size, cqt->mono, cqt->multires);
+    int fft1 = fft1_size(fft_size, cqt->multires, dec_bits);
+    int exp_size = ALIGN16(fft_tbl_size(fft0) * sizeof(Complex));
+    int kernel_size_b = ALIGN16(kernel_bytes(kernel_size, cqt->compact));
+    int scale_size = cqt->compact ? ALIGN16(cqt->t_size * sizeof(float)) : 0;
+    int tiles_size = ALIGN16(tile_count * sizeof(KernelTile));
+    int attack_bytes = ALIGN16(cqt->attack_size * sizeof(float));
+    int rfft_size = cqt->mono ? ALIGN16((fft_size >> 2) * sizeof(Complex)) : 0;
+    int exp1_size = fft1 ? ALIGN16(fft_tbl_size(fft1) * sizeof(Complex)) : 0;
+    uint8_t *p = mem_alloc(ALIGN16(sizeof(ShowCQTTables)) + exp_size + kernel_size_b + scale_size + tiles_size +
+                           attack_bytes + rfft_size + exp1_size);
+    ShowCQTTables *t = (ShowCQTTables *) p;
+
+    p += ALIGN16(sizeof(ShowCQTTables));
+    t->exp_tbl = (Complex *) p;
+    t->kernel = (float *)(p += exp_size);
+    t->kernel16 = (int16_t *) p;
+    t->kernel_scale = (float *)(p += kernel_size_b);
+    t->tiles = (KernelTile *)(p += scale_size);
+    t->attack_tbl = (float *)(p += tiles_size);
+    t->rfft_tbl = (Complex *)(p += attack_bytes);
+    t->exp_tbl1 = (Complex *)(p += rfft_size);
+
+    t->refcount = 0;
+    t->rate = rate;
+    t->width = cqt->width;
+    t->super = !!super;
+    t->mono = cqt->mono;
+    t->multires = cqt->multires;
+    t->compact = cqt->compact;
+    t->fmin = cqt->fmin;
+    t->fmax = cqt->fmax;
+    t->fft_size = fft_size;
+    t->t_size = cqt->t_size;
+    t->attack_size = cqt->attack_size;
+    t->kernel_size = kernel_size;
+    t->tile_count = tile_count;
+    t->split = split;
+    t->dec_bits = dec_bits;
+    t->next = tables_list;
+    tables_list = t;
+    return t;
+}
 
-    cqt.width = width;
-    cqt.height = height;
-    cqt.aligned_width = WASM_SIMD ? 4 * ceil(width * 0.25) : width;
+/* bins are spaced evenly in log frequency over [fmin, fmax] */
+static double bin_freq(int f, int t_size, double fmin, double fmax)
+{
+    double log_base = log(fmin);
+    double log_end = log(fmax);
+    return exp(log_base + (f + 0.5) * (log_end - log_base) * (1.0/t_size));
+}
 
-    cqt.bar_v = (bar_v > MAX_VOL) ? MAX_VOL : (bar_v > MIN_VOL) ? bar_v : MIN_VOL;
-    cqt.sono_v = (sono_v > MAX_VOL) ? MAX_VOL : (sono_v > MIN_VOL) ? sono_v : MIN_VOL;
+/* returns the (aligned) kernel length of bin f, 0 if it is above nyquist */
+static int kernel_bin(int f, int t_size, double fmin, double fmax, int rate, int fft_size,
+                      double *center, double *flen, int *start, int *end)
+{
+    double freq = bin_freq(f, t_size, fmin, fmax);
 
-    if (rate < 8000 || rate > 100000)
+    if (freq >= 0.5 * rate)
         return 0;
 
-    int bits = ceil(log(rate * 0.33)/ M_LN2);
-    if (bits > 20 || bits < 12)
-        return 0;
-    cqt.fft_size = 1 << bits;
-    if (cqt.fft_size > MAX_FFT_SIZE)
-        return 0;
+    *flen = 8.0 * fft_size / (kernel_tlen(freq) * rate);
+    *center = freq * fft_size / rate;
+    *start = ceil(*center - 0.5 * *flen);
+    *end = floor(*center + 0.5 * *flen);
+    int len = *end - *start + 1;
+    return WASM_SIMD ? 4 * ceil(len * 0.25) : len;
+}
 
-    gen_perm_tbl(bits - 2);
-    gen_exp_tbl(cqt.fft_size);
+/* Group adjacent bins of the same level into tiles while the span of a tile stays within TILE_WASTE
+ * times the windows of its bins, bins above nyquist get tiles of zero length. Fills tiles unless it
+ * is null, returns the number of tiles. */
+#define TILE_WASTE 1.25
 
-    cqt.attack_size = ceil(rate * 0.033);
-    for (int x = 0; x < cqt.attack_size; x++) {
-        double y = M_PI * x / (rate * 0.033);
-        cqt.attack_tbl[x] = 0.355768 + 0.487396 * cos(y) + 0.144232 * cos(2*y) + 0.012604 * cos(3*y);
+static int kernel_tiles(const ShowCQT *cqt, int rate, int bits, int split, KernelTile *tiles, int *kernel_size)
+{
+    double center, flen;
+    int start, end, count = 0, size = 0;
+    int tile_start = 0, tile_end = 0, tile_x = 0, tile_bins = 0, tile_own = 0;
+
+    for (int f = 0; f <= cqt->t_size; f++) {
+        int n = f < split ? 1 << bits : fft0_size(1 << bits, 0, cqt->multires);
+        int len = f < cqt->t_size ? kernel_bin(f, cqt->t_size, cqt->fmin, cqt->fmax, rate, n, &center, &flen, &start, &end) : 0;
+        int own = len ? end - start + 1 : 0;
+
+        if (tile_bins) {
+            int s = start < tile_start ? start : tile_start, e = end > tile_end ? end : tile_end;
+            int span = len ? (e - s + TILE_STEP) / TILE_STEP * TILE_STEP : 0;
+            if (f < cqt->t_size && tile_bins < TILE_BINS && (f < split) == (tile_x < split) &&
+                !len == !tile_own && span * (tile_bins + 1) <= TILE_WASTE * (tile_own + own)) {
+                tile_start = s;
+                tile_end = e;
+                tile_bins++;
+                tile_own += own;
+                continue;
+            }
+
+            int tile_len = tile_own ? (tile_end - tile_start + TILE_STEP) / TILE_STEP * TILE_STEP : 0;
+            if (tiles)
+                tiles[count] = (KernelTile){ tile_own ? tile_start : 0, tile_len, tile_x, tile_bins };
+            size += tile_len * tile_bins;
+            count++;
+        }
+
+        tile_start = start;
+        tile_end = end;
+        tile_x = f;
+        tile_bins = 1;
+        tile_own = own;
     }
 
-    cqt.kernel = memory_expand(0);
-    cqt.t_size = cqt.width * (1 + !!super);
-    double log_base = log(20.01523126408007475);
-    double log_end = log(20495.59681441799654);
-    for (int f = 0, idx = 0; f < cqt.t_size; f++) {
-        double freq = exp(log_base + (f + 0.5) * (log_end - log_base) * (1.0/cqt.t_size));
+    *kernel_size = size;
+    return count;
+}
 
-        if (freq >= 0.5 * rate) {
-            cqt.kernel_index[f].len = 0;
-            cqt.kernel_index[f].start = 0;
-            continue;
+/* multires: a bin whose kernel spans at least MULTIRES_FLEN bins of the full fft has a time support
+ * of at most fft_size/4 samples, so it fits the short window */
+#define MULTIRES_FLEN 32.0
+
+/* Finds the bin of tables d whose kernel equals that of a new bin of frequency freq with the window
+ * (n, center, flen, start, end). Bins are looked up in increasing frequency, *k and *offset walk the
+ * tiles of d to the tile of the bin. Returns the bin, or -1 if d has none. */
+static int donor_bin(const ShowCQTTables *d, double freq, int n, double center, double flen, int start, int end,
+                     int *k, int *offset)
+{
+    double c, fl;
+    int s, e;
+    int g = floor((log(freq) - log(d->fmin)) * d->t_size / (log(d->fmax) - log(d->fmin)));
+    if (g < 0 || g >= d->t_size)
+        return -1;
+
+    int dn = g < d->split ? d->fft_size : fft0_size(d->fft_size, 0, d->multires);
+    if (dn != n || !kernel_bin(g, d->t_size, d->fmin, d->fmax, d->rate, dn, &c, &fl, &s, &e) ||
+        s != start || e != end || c - center > 1e-9 || center - c > 1e-9 || fl - flen > 1e-9 || flen - fl > 1e-9)
+        return -1;
+
+    while (d->tiles[*k].x + d->tiles[*k].bins <= g)
+        *offset += tile_size(&d->tiles[(*k)++]);
+    return g;
+}
+
+/* Builds the tables of cqt, the kernel of bins with the same window as a bin of donor (if not null)
+ * is copied from it instead of being computed. */
+static ShowCQTTables *tables_build(const ShowCQT *cqt, int rate, int super, int bits, const ShowCQTTables *donor)
+{
+    double center, flen;
+    int start, end, kernel_size, split = 0, long_end = 0, dec_bits = 0;
+    for (int f = 0; cqt->multires && f < cqt->t_size; f++) {
+        int len = kernel_bin(f, cqt->t_size, cqt->fmin, cqt->fmax, rate, 1 << bits, &center, &flen, &start, &end);
+        if (len && flen < MULTIRES_FLEN) {
+            split = f + 1;
+            long_end = start + len;
         }
+    }
 
-        double tlen = 384*0.33 / (384/0.17 + 0.33*freq/(1-0.17)) + 384*0.33 / (0.33*freq/0.17 + 384/(1-0.17));
-        double flen = 8.0 * cqt.fft_size / (tlen * rate);
-        double center = freq * cqt.fft_size / rate;
-        int start = ceil(center - 0.5*flen);
-        int end = floor(center + 0.5*flen);
-        int len = end - start + 1;
-        len = WASM_SIMD ? 4 * ceil(len * 0.25) : len;
-        memory_expand(len * sizeof(float));
+    /* keep the long window bins below 1/4 of the decimated nyquist, the passband of dec_coef */
+    while (split && dec_bits < bits - 10 && 4 * long_end <= (1 << (bits - dec_bits - 1)))
+        dec_bits++;
+
+    int tile_count = kernel_tiles(cqt, rate, bits, split, 0, &kernel_size);
+    ShowCQTTables *t = tables_alloc(cqt, rate, super, bits, kernel_size, tile_count, split, dec_bits);
+    kernel_tiles(cqt, rate, bits, split, t->tiles, &kernel_size);
+    int fft0 = fft0_size(t->fft_size, t->mono, t->multires);
+    int fft1 = fft1_size(t->fft_size, t->multires, t->dec_bits);
+    gen_exp_tbl(t->exp_tbl, fft0);
+    if (fft1)
+        gen_exp_tbl(t->exp_tbl1, fft1);
+
+    if (t->mono) {
+        RootTable r;
+        roots_init(&r, t->fft_size);
+        for (int x = 0; x < t->fft_size >> 2; x++)
+            t->rfft_tbl[x] = root(&r, x);
+    }
 
-        cqt.kernel_index[f].len = len;
-        cqt.kernel_index[f].start = start;
+    CosRotor rot;
+    rotor_init(&rot, 0, M_PI / (rate * 0.033));
+    for (int x = 0; x < t->attack_size; x++)
+        t->attack_tbl[x] = nuttall(rotor_next(&rot));
+
+    if (donor && donor->compact != t->compact)
+        donor = 0;
+
+    for (int k = 0, offset = 0, dk = 0, doffset = 0; k < t->tile_count; k++) {
+        const KernelTile *tile = &t->tiles[k];
+        for (int b = 0; b < tile->bins; b++) {
+            /* decimation keeps the bins of the long window, so its kernel is the full fft kernel */
+            int f = tile->x + b;
+            int n = f < t->split ? t->fft_size : fft0_size(t->fft_size, 0, t->multires);
+            int len = kernel_bin(f, t->t_size, t->fmin, t->fmax, rate, n, &center, &flen, &start, &end);
+            int g = donor && len ? donor_bin(donor, center * rate / n, n, center, flen, start, end, &dk, &doffset) : -1;
+            const KernelTile *dt = g >= 0 ? &donor->tiles[dk] : 0;
+
+            /* compact: the window peaks at the tap nearest to center, it gets the largest int16 */
+            double scale = 0;
+            if (t->compact && dt) {
+                scale = t->kernel_scale[f] = donor->kernel_scale[g];
+            } else if (t->compact) {
+                double y = 2.0 * M_PI * (floor(center + 0.5) - center) * (1.0 / flen);
+                scale = nuttall(cos(y)) * (1.0/n) * (1.0/32767);
+                t->kernel_scale[f] = scale;
+            }
 
-        for (int x = start; x < start + len; x++) {
-            if (x > end) {
-                cqt.kernel[idx+x-start] = 0;
-                continue;
+            rotor_init(&rot, 2.0 * M_PI * (start - center) * (1.0 / flen), 2.0 * M_PI * (1.0 / flen));
+            for (int m = 0; m < tile->len; m++) {
+                int x = tile->start + m;
+                int i = offset + (m / TILE_STEP * tile->bins + b) * TILE_STEP + m % TILE_STEP;
+                if (dt && x >= start && x <= end) {
+                    int dm = x - dt->start;
+                    int di = doffset + (dm / TILE_STEP * dt->bins + g - dt->x) * TILE_STEP + dm % TILE_STEP;
+                    if (t->compact)
+                        t->kernel16[i] = donor->kernel16[di];
+                    else
+                        t->kernel[i] = donor->kernel[di];
+                    continue;
+                }
+                double w = 0;
+                if (x >= start && x <= end) {
+                    int sign = (x & 1) ? (-1) : 1;
+                    w = nuttall(rotor_next(&rot)) * sign * (1.0/n);
+                }
+                if (t->compact) {
+                    int q = w / scale + (w >= 0 ? 0.5 : -0.5);
+                    t->kernel16[i] = q > 32767 ? 32767 : q < -32767 ? -32767 : q;
+                } else {
+                    t->kernel[i] = w;
+                }
             }
-            int sign = (x & 1) ? (-1) : 1;
-            double y = 2.0 * M_PI * (x - center) * (1.0 / flen);
-            double w = 0.355768 + 0.487396 * cos(y) + 0.144232 * cos(2*y) + 0.012604 * cos(3*y);
-            w *= sign * (1.0/cqt.fft_size);
-            cqt.kernel[idx+x-start] = w;
         }
-
-        idx += len;
+        offset += tile_size(tile);
     }
-    return cqt.fft_size;
+    return t;
 }
 
-#if !WASM_SIMD
-static Complex cqt_calc(const float *kernel, int start, int len)
+WASM_EXPORT int init(ShowCQT *cqt, int rate, int width, int height, float bar_v, float sono_v, int super, int flags)
 {
-    Complex a = { 0, 0 }, b = { 0, 0 };
+    int bits = init_props(cqt, rate, width, height, bar_v, sono_v, super, flags);
+    if (!bits)
+        return 0;
 
-    for (int m = 0, i = start, j = cqt.fft_size - start; m < len; m++, i++, j--) {
-        float u = kernel[m];
-        a.re += u * cqt.fft_buf[i].re;
-        a.im += u * cqt.fft_buf[i].im;
-        b.re += u * cqt.fft_buf[j].re;
-        b.im += u * cqt.fft_buf[j].im;
+    rate /= cqt->input_dec;
+    ShowCQTTables *t = tables_find(cqt, rate, super);
+    return attach_tables(cqt, t ? t : tables_build(cqt, rate, super, bits, 0));
+}
+
+/* Sets the frequency range of the bins, (0, 0) restores the default, bins per octave are
+ * t_size / log2(fmax / fmin). An initialized context gets new tables right away: bins whose window
+ * does not change (e.g. when the range moves by whole bins at the same fft size) copy their kernel
+ * from the old tables. Returns fft_size, which follows fmin, 1 before init(), 0 if the range is invalid. */
+WASM_EXPORT int set_range(ShowCQT *cqt, double fmin, double fmax)
+{
+    if (!fmin && !fmax) {
+        fmin = DEFAULT_FMIN;
+        fmax = DEFAULT_FMAX;
     }
+    if (!(fmin >= MIN_FREQ && fmax > fmin && fmax <= MAX_FREQ))
+        return 0;
 
-    Complex v0 = { a.re + b.re, a.im - b.im };
-    Complex v1 = { b.im + a.im, b.re - a.re };
-    float r0 = v0.re*v0.re + v0.im*v0.im;
-    float r1 = v1.re*v1.re + v1.im*v1.im;
-    return (Complex){ r0, r1 };
+    cqt->fmin = fmin;
+    cqt->fmax = fmax;
+    ShowCQTTables *old = cqt->tables;
+    if (!old)
+        return 1;
+
+    ShowCQTTables *t = tables_find(cqt, old->rate, old->super);
+    if (!t)
+        t = tables_build(cqt, old->rate, old->super, fft_bits(old->rate, fmin), old);
+    cqt->input_pos = 0;
+    attach_tables(cqt, t);
+    tables_release(old);
+    return cqt->fft_size;
 }
-#else
-static WASM_SIMD_FUNCTION Complex cqt_calc(const float *kernel, int start, int len)
-{
-    Complex4 a = { { 0, 0, 0, 0 }, { 0, 0, 0, 0 } };
-    Complex4 b = a;
-
-    for (int m = 0, i = start, j = cqt.fft_size - start - 3; m < len; m += 4, i += 4, j -= 4) {
-        float32x4 u = *(const float32x4 *)(kernel + m);
-        Complex4 vi = c4_load_uc(cqt.fft_buf + i);
-        Complex4 vj = c4_load_uc_reverse(cqt.fft_buf + j);
-        a.re += u * vi.re;
-        a.im += u * vi.im;
-        b.re += u * vj.re;
-        b.im += u * vj.im;
-    }
-
-    Complex4 v0 = { a.re + b.re, a.im - b.im };
-    Complex4 v1 = { b.im + a.im, b.re - a.re };
-    float32x4 v0a = __builtin_shufflevector(v0.re, v0.im, 0, 2, 4, 6);
-    float32x4 v0b = __builtin_shufflevector(v0.re, v0.im, 1, 3, 5, 7);
-    float32x4 v0c = v0a + v0b;
-    float32x4 v1a = __builtin_shufflevector(v1.re, v1.im, 0, 2, 4, 6);
-    float32x4 v1b = __builtin_shufflevector(v1.re, v1.im, 1, 3, 5, 7);
-    float32x4 v1c = v1a + v1b;
-    float32x4 v2a = __builtin_shufflevector(v0c, v1c, 0, 2, 4, 6);
-    float32x4 v2b = __builtin_shufflevector(v0c, v1c, 1, 3, 5, 7);
-    float32x4 v2c = v2a + v2b;
-    v2c *= v2c;
-    float32x4 v3a = __builtin_shufflevector(v2c, v2c, 0, 2, 4, 6);
-    float32x4 v3b = __builtin_shufflevector(v2c, v2c, 1, 3, 4, 6);
-    float32x4 v3c = v3a + v3b;
-    return (Complex){ v3c[0], v3c[1] };
-}
-#endif
-
-WASM_EXPORT WASM_SIMD_FUNCTION void calc(void)
-{
-    int fft_size_h = cqt.fft_size >> 1;
-    int fft_size_q = cqt.fft_size >> 2;
-    int shift = fft_size_h - cqt.attack_size;
-
-    for (int x = 0; x < cqt.attack_size; x++) {
-        int i = 4 * cqt.perm_tbl[x];
-        cqt.fft_buf[i] = (Complex){ cqt.input[0][shift+x], cqt.input[1][shift+x] };
-        cqt.fft_buf[i+1].re = cqt.attack_tbl[x] * cqt.input[0][fft_size_h+shift+x];
-        cqt.fft_buf[i+1].im = cqt.attack_tbl[x] * cqt.input[1][fft_size_h+shift+x];
-        cqt.fft_buf[i+2] = (Complex){ cqt.input[0][fft_size_q+shift+x], cqt.input[1][fft_size_q+shift+x] };
-        cqt.fft_buf[i+3] = (Complex){0,0};
-    }
-
-    for (int x = cqt.attack_size; x < fft_size_q; x++) {
-        int i = 4 * cqt.perm_tbl[x];
-        cqt.fft_buf[i] = (Complex){ cqt.input[0][shift+x], cqt.input[1][shift+x] };
-        cqt.fft_buf[i+1] = (Complex){0,0};
-        cqt.fft_buf[i+2] = (Complex){ cqt.input[0][fft_size_q+shift+x], cqt.input[1][fft_size_q+shift+x] };
-        cqt.fft_buf[i+3] = (Complex){0,0};
-    }
-
-    fft_calc(cqt.fft_buf, cqt.fft_size);
-
-    const float *kernel = cqt.kernel;
-    for (int x = 0; x < cqt.t_size; x++) {
-        int len = cqt.kernel_index[x].len;
-        int start = cqt.kernel_index[x].start;
-        if (!len) {
-            cqt.color_buf[x] = (ColorF){0,0,0,0};
-            continue;
-        }
 
-        Complex r = cqt_calc(kernel, start, len);
 
-        cqt.color_buf[x].r = sqrtf(cqt.sono_v * sqrtf(r.re));
-        cqt.color_buf[x].g = sqrtf(cqt.sono_v * sqrtf(0.5f * (r.re + r.im)));
-        cqt.color_buf[x].b = sqrtf(cqt.sono_v * sqrtf(r.im));
-        cqt.color_buf[x].h = cqt.bar_v * sqrtf(0.5f * (r.re + r.im));
+static int copy_words(void *dst, const void *src, int size)
+{
+    typedef uint32_t __attribute__((__may_alias__)) word;
+    word *d = dst;
+    const word *s = src;
+    for (int x = 0; x < size >> 2; x++)
+        d[x] = s[x];
+    return size;
+}
 
-        kernel += len;
-    }
+static int kernel_blob_size(int fft0, int fft1, int rfft, int tile_count, int attack_size, int kernel_size, int compact, int t_size)
+{
+    return sizeof(KernelBlobHeader) + kernel_bytes(kernel_size, compact) + (compact ? t_size * sizeof(float) : 0) +
+           tile_count * sizeof(KernelTile) +
+           fft_tbl_size(fft0) * sizeof(Complex) + attack_size * sizeof(float) + rfft * sizeof(Complex) +
+           (fft1 ? fft_tbl_size(fft1) * sizeof(Complex) : 0);
+}
 
-    if (cqt.t_size != cqt.width) {
-        for (int x = 0; x < cqt.width; x++) {
-            cqt.color_buf[x].r = 0.5f * (cqt.color_buf[2*x].r + cqt.color_buf[2*x+1].r);
-            cqt.color_buf[x].g = 0.5f * (cqt.color_buf[2*x].g + cqt.color_buf[2*x+1].g);
-            cqt.color_buf[x].b = 0.5f * (cqt.color_buf[2*x].b + cqt.color_buf[2*x+1].b);
-            cqt.color_buf[x].h = 0.5f * (cqt.color_buf[2*x].h + cqt.color_buf[2*x+1].h);
-        }
-    }
+WASM_EXPORT int kernel_export_size(ShowCQT *cqt)
+{
+    const ShowCQTTables *t = cqt->tables;
+    if (!t)
+        return 0;
+    return kernel_blob_size(fft0_size(t->fft_size, t->mono, t->multires), fft1_size(t->fft_size, t->multires, t->dec_bits),
+                            t->mono ? t->fft_size >> 2 : 0, t->tile_count, t->attack_size, t->kernel_size,
+                            t->compact, t->t_size);
+}
+
+WASM_EXPORT int kernel_export(ShowCQT *cqt, uint8_t *dst)
+{
+    const ShowCQTTables *t = cqt->tables;
+    KernelBlobHeader *hdr = (KernelBlobHeader *) dst;
+    if (!t)
+        return 0;
 
-    cqt.prerender = 1;
+    int fft0 = fft0_size(t->fft_size, t->mono, t->multires);
+    int fft1 = fft1_size(t->fft_size, t->multires, t->dec_bits);
+    hdr->magic = KERNEL_BLOB_MAGIC;
+    hdr->version = KERNEL_BLOB_VERSION;
+    hdr->simd = WASM_SIMD;
+    hdr->rate = t->rate;
+    hdr->width = t->width;
+    hdr->super = t->super;
+    hdr->fft_size = t->fft_size;
+    hdr->attack_size = t->attack_size;
+    hdr->t_size = t->t_size;
+    hdr->kernel_size = t->kernel_size;
+    hdr->mono = t->mono;
+    hdr->multires = t->multires;
+    hdr->split = t->split;
+    hdr->dec_bits = t->dec_bits;
+    hdr->tile_count = t->tile_count;
+    hdr->compact = t->compact;
+    hdr->fmin = t->fmin;
+    hdr->fmax = t->fmax;
+
+    dst += sizeof(KernelBlobHeader);
+    dst += copy_words(dst, t->kernel, kernel_bytes(t->kernel_size, t->compact));
+    if (t->compact)
+        dst += copy_words(dst, t->kernel_scale, t->t_size * sizeof(float));
+    dst += copy_words(dst, t->tiles, t->tile_count * sizeof(KernelTile));
+    dst += copy_words(dst, t->exp_tbl, fft_tbl_size(fft0) * sizeof(Complex));
+    dst += copy_words(dst, t->attack_tbl, t->attack_size * sizeof(float));
+    if (t->mono)
+        dst += copy_words(dst, t->rfft_tbl, (t->fft_size >> 2) * sizeof(Complex));
+    if (fft1)
+        dst += copy_words(dst, t->exp_tbl1, fft_tbl_size(fft1) * sizeof(Complex));
+    return kernel_export_size(cqt);
 }
 
-static void prerender(void)
+/* the tiles cover bins 0 .. t_size-1 in order and stay inside their fft, n1 points below split and n0 above */
+static int tiles_valid(const KernelTile *tiles, int tile_count, int t_size, int kernel_size, int split, int n1, int n0)
 {
-    for (int x = 0; x < cqt.width; x++) {
-        ColorF *c = cqt.color_buf;
-        c[x].r = 255.5f * (c[x].r >= 0.0f ? (c[x].r <= 1.0f ? c[x].r : 1.0f) : 0.0f);
-        c[x].g = 255.5f * (c[x].g >= 0.0f ? (c[x].g <= 1.0f ? c[x].g : 1.0f) : 0.0f);
-        c[x].b = 255.5f * (c[x].b >= 0.0f ? (c[x].b <= 1.0f ? c[x].b : 1.0f) : 0.0f);
-        c[x].h = c[x].h >= 0.0f ? c[x].h : 0.0f;
+    int x = 0;
+    for (int k = 0; k < tile_count; k++) {
+        const KernelTile *tile = &tiles[k];
+        int n = tile->x < split ? n1 : n0;
+        if (tile->x != x || tile->bins < 1 || tile->bins > TILE_BINS || tile->len < 0 || tile->len % TILE_STEP ||
+            (tile->len && (tile->start < 1 || tile->start + tile->len > n)))
+            return 0;
+        x += tile->bins;
+        kernel_size -= tile_size(tile);
     }
+    return x == t_size && !kernel_size;
+}
 
-#if WASM_SIMD
-    for (int x = cqt.width; x < cqt.aligned_width; x++) {
-        cqt.color_buf[x] = (ColorF){ 0, 0, 0, 0 };
-    }
-#endif
+/* Initialize from a kernel_export() blob. Returns fft_size, or 0 if the blob does not match. */
+WASM_EXPORT int init_import(ShowCQT *cqt, int rate, int width, int height, float bar_v, float sono_v, int super,
+                            int flags, const uint8_t *src, int size)
+{
+    int bits = init_props(cqt, rate, width, height, bar_v, sono_v, super, flags);
+    const KernelBlobHeader *hdr = (const KernelBlobHeader *) src;
+    if (!bits || size < (int) sizeof(KernelBlobHeader))
+        return 0;
 
-    for (int x = 0; x < cqt.aligned_width; x++)
-        cqt.rcp_h_buf[x] = 1.0f / (cqt.color_buf[x].h + 0.0001f);
+    rate /= cqt->input_dec;
+    ShowCQTTables *t = tables_find(cqt, rate, super);
+    if (t)
+        return attach_tables(cqt, t);
+
+    if (hdr->magic != KERNEL_BLOB_MAGIC || hdr->version != KERNEL_BLOB_VERSION || hdr->simd != WASM_SIMD ||
+        hdr->rate != rate || hdr->width != width || hdr->super != !!super ||
+        hdr->mono != cqt->mono || hdr->multires != cqt->multires || hdr->compact != cqt->compact ||
+        hdr->fmin != cqt->fmin || hdr->fmax != cqt->fmax ||
+        hdr->fft_size != (1 << bits) || hdr->attack_size != cqt->attack_size || hdr->t_size != cqt->t_size ||
+        hdr->split < 0 || hdr->split > hdr->t_size || hdr->dec_bits < 0 || hdr->dec_bits > bits - 10 ||
+        hdr->kernel_size < 0 || hdr->kernel_size > (size >> 2) || hdr->tile_count < 0 || hdr->tile_count > hdr->t_size ||
+        kernel_blob_size(fft0_size(hdr->fft_size, hdr->mono, hdr->multires), fft1_size(hdr->fft_size, hdr->multires, hdr->dec_bits),
+                         hdr->mono ? hdr->fft_size >> 2 : 0, hdr->tile_count, hdr->attack_size, hdr->kernel_size,
+                         hdr->compact, hdr->t_size) != size ||
+        !tiles_valid((const KernelTile *)(src + sizeof(KernelBlobHeader) + kernel_bytes(hdr->kernel_size, hdr->compact) +
+                                          (hdr->compact ? hdr->t_size * sizeof(float) : 0)),
+                     hdr->tile_count, hdr->t_size, hdr->kernel_size, hdr->split, hdr->fft_size >> hdr->dec_bits,
+                     fft0_size(hdr->fft_size, 0, hdr->multires)))
+        return 0;
 
-#if WASM_SIMD
-    for (int x = 0; x < cqt.aligned_width; x += 4) {
-        ColorF4 color;
-        color.r = (float32x4){ cqt.color_buf[x].r, cqt.color_buf[x+1].r, cqt.color_buf[x+2].r, cqt.color_buf[x+3].r };
-        color.g = (float32x4){ cqt.color_buf[x].g, cqt.color_buf[x+1].g, cqt.color_buf[x+2].g, cqt.color_buf[x+3].g };
-        color.b = (float32x4){ cqt.color_buf[x].b, cqt.color_buf[x+1].b, cqt.color_buf[x+2].b, cqt.color_buf[x+3].b };
-        color.h = (float32x4){ cqt.color_buf[x].h, cqt.color_buf[x+1].h, cqt.color_buf[x+2].h, cqt.color_buf[x+3].h };
-        *(ColorF4 *)(cqt.color_buf + x) = color;
-    }
-#endif
+    t = tables_alloc(cqt, rate, super, bits, hdr->kernel_size, hdr->tile_count, hdr->split, hdr->dec_bits);
+    int fft0 = fft0_size(t->fft_size, t->mono, t->multires);
+    int fft1 = fft1_size(t->fft_size, t->multires, t->dec_bits);
+    src += sizeof(KernelBlobHeader);
+    src += copy_words(t->kernel, src, kernel_bytes(t->kernel_size, t->compact));
+    if (t->compact)
+        src += copy_words(t->kernel_scale, src, t->t_size * sizeof(float));
+    src += copy_words(t->tiles, src, t->tile_count * sizeof(KernelTile));
+    src += copy_words(t->exp_tbl, src, fft_tbl_size(fft0) * sizeof(Complex));
+    src += copy_words(t->attack_tbl, src, t->attack_size * sizeof(float));
+    if (t->mono)
+        src += copy_words(t->rfft_tbl, src, (t->fft_size >> 2) * sizeof(Complex));
+    if (fft1)
+        src += copy_words(t->exp_tbl1, src, fft_tbl_size(fft1) * sizeof(Complex));
+    return attach_tables(cqt, t);
+}
 
-    cqt.prerender = 0;
+WASM_EXPORT int init_sono(ShowCQT *cqt, int lines)
+{
+    mem_free(cqt->sono_buf);
+    cqt->sono_buf = 0;
+    cqt->sono_lines = 0;
+    cqt->sono_head = 0;
+    if (lines <= 0 || lines > MAX_HEIGHT || !cqt->fft_size)
+        return 0;
+
+    /* render_sono() reads a row SIMD_WIDTH pixels at a time */
+    cqt->sono_buf = mem_alloc((lines * cqt->width + SIMD_WIDTH) * sizeof(unsigned));
+    for (int x = 0; x < lines * cqt->width; x++)
+        cqt->sono_buf[x] = 0xFF000000;
+    cqt->sono_lines = lines;
+    return lines;
+}
+
+/* coefficient i of a tile, widened from int16 if compact */
+static ALWAYS_INLINE float kernel_coef(const void *kernel, int i, int compact)
+{
+    return compact ? ((const int16_t *) kernel)[i] : ((const float *) kernel)[i];
 }
 
 #if !WASM_SIMD
-WASM_EXPORT void render_line_alpha(int y, uint8_t alpha)
+/* powers of the bins of a tile, left in re and right in im. With p = a + conj(b) and q = -i * (a - conj(b)),
+ * where a and b are the bins at i and n - i, each fft bin is loaded once for all bins of the tile. */
+static ALWAYS_INLINE void cqt_calc_tile(const Complex *buf, int n, const void *kernel, const KernelTile *tile,
+                                        Complex *r, int bins, int compact)
 {
-    if (cqt.prerender)
-        prerender();
+    Complex v0[TILE_BINS], v1[TILE_BINS];
+    for (int b = 0; b < bins; b++)
+        v0[b] = v1[b] = (Complex){ 0, 0 };
+
+    for (int m = 0, i = tile->start, j = n - tile->start, o = 0; m < tile->len; m++, i++, j--, o += bins) {
+        Complex p = { buf[i].re + buf[j].re, buf[i].im - buf[j].im };
+        Complex q = { buf[i].im + buf[j].im, buf[j].re - buf[i].re };
+        for (int b = 0; b < bins; b++) {
+            float u = kernel_coef(kernel, o + b, compact);
+            v0[b].re += u * p.re;
+            v0[b].im += u * p.im;
+            v1[b].re += u * q.re;
+            v1[b].im += u * q.im;
+        }
+    }
 
-    unsigned a = ((unsigned) alpha) << 24;
+    for (int b = 0; b < bins; b++)
+        r[b] = (Complex){ v0[b].re*v0[b].re + v0[b].im*v0[b].im, v1[b].re*v1[b].re + v1[b].im*v1[b].im };
+}
 
-    if (y >= 0 && y < cqt.height) {
-        float ht = (cqt.height - y) / (float) cqt.height;
-        for (int x = 0; x < cqt.width; x++) {
-            if (cqt.color_buf[x].h <= ht) {
-                cqt.output[x] = a;
-            } else {
-                float mul = (cqt.color_buf[x].h - ht) * cqt.rcp_h_buf[x];
-                int r = mul * cqt.color_buf[x].r;
-                int g = mul * cqt.color_buf[x].g;
-                int b = mul * cqt.color_buf[x].b;
-                g = g << 8;
-                b = b << 16;
-                cqt.output[x] = (r | g) | (b | a);
-            }
-        }
-    } else {
-        for (int x = 0; x < cqt.width; x++) {
-            int r = cqt.color_buf[x].r;
-            int g = cqt.color_buf[x].g;
-            int b = cqt.color_buf[x].b;
-            g = g << 8;
-            b = b << 16;
-            cqt.output[x] = (r | g) | (b | a);
+static ALWAYS_INLINE void cqt_calc_tile_mono(const Complex *buf, const void *kernel, const KernelTile *tile,
+                                             float *r, int bins, int compact)
+{
+    Complex a[TILE_BINS];
+    for (int b = 0; b < bins; b++)
+        a[b] = (Complex){ 0, 0 };
+
+    for (int m = 0, i = tile->start, o = 0; m < tile->len; m++, i++, o += bins) {
+        Complex v = buf[i];
+        for (int b = 0; b < bins; b++) {
+            float u = kernel_coef(kernel, o + b, compact);
+            a[b].re += u * v.re;
+            a[b].im += u * v.im;
         }
     }
+
+    for (int b = 0; b < bins; b++)
+        r[b] = a[b].re*a[b].re + a[b].im*a[b].im;
 }
 #else
-WASM_EXPORT WASM_SIMD_FUNCTION void render_line_alpha(int y, uint8_t alpha)
-{
-    if (cqt.prerender)
-        prerender();
-
-    uint32x4 a = { alpha, alpha, alpha, alpha };
-    a = a << 24;
-
-    if (y >= 0 && y < cqt.height) {
-        float htf = (cqt.height - y) / (float) cqt.height;
-        float32x4 ht = { htf, htf, htf, htf };
-        for (int x = 0; x < cqt.aligned_width; x += 4) {
-            ColorF4 color = *(ColorF4 *)(cqt.color_buf + x);
-            int32x4 mask = color.h > ht;
-            if (__builtin_wasm_any_true_v128(mask)) {
-                float32x4 mul = (color.h - ht) * *(float32x4 *)(cqt.rcp_h_buf + x);
-                mul = (float32x4)((int32x4)mul & mask);
-                int32x4 r = __builtin_convertvector(mul * color.r, int32x4);
-                int32x4 g = __builtin_convertvector(mul * color.g, int32x4);
-                int32x4 b = __builtin_convertvector(mul * color.b, int32x4);
-                g = g << 8;
-                b = b << 16;
-                *(int32x4 *)(cqt.output + x) = (r | g) | (b | a);
-            } else {
-                *(int32x4 *)(cqt.output + x) = a;
-            }
-        }
-    } else {
-        for (int x = 0; x < cqt.aligned_width; x += 4) {
-            ColorF4 color = *(ColorF4 *)(cqt.color_buf + x);
-            int32x4 r = __builtin_convertvector(color.r, int32x4);
-            int32x4 g = __builtin_convertvector(color.g, int32x4);
-            int32x4 b = __builtin_convertvector(color.b, int32x4);
-            g = g << 8;
-            b = b << 16;
-            *(int32x4 *)(cqt.output + x) = (r | g) | (b | a);
-        }
-    }
+#if SIMD_WIDTH >= 8
+static ALWAYS_INLINE WASM_SIMD_FUNCTION float32x8 f8_dup(float32x4 v)
+{
+    return __builtin_shufflevector(v, v, 0, 1, 2, 3, 0, 1, 2, 3);
+}
+
+static ALWAYS_INLINE WASM_SIMD_FUNCTION float32x4 f8_half(float32x8 v, int k)
+{
+    return k ? __builtin_shufflevector(v, v, 4, 5, 6, 7) : __builtin_shufflevector(v, v, 0, 1, 2, 3);
 }
 #endif
 
-WASM_EXPORT void render_line_opaque(int y)
+#if SIMD_WIDTH >= 16
+static ALWAYS_INLINE WASM_SIMD_FUNCTION float32x16 f16_dup(float32x4 v)
 {
-    render_line_alpha(y, 255);
+    float32x8 d = f8_dup(v);
+    return __builtin_shufflevector(d, d, 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7);
 }
 
-WASM_EXPORT void set_volume(float bar_v, float sono_v)
+static ALWAYS_INLINE WASM_SIMD_FUNCTION float32x8 f16_half(float32x16 v, int k)
 {
-    cqt.bar_v = (bar_v > MAX_VOL) ? MAX_VOL : (bar_v > MIN_VOL) ? bar_v : MIN_VOL;
-    cqt.sono_v = (sono_v > MAX_VOL) ? MAX_VOL : (sono_v > MIN_VOL) ? sono_v : MIN_VOL;
+    return k ? __builtin_shufflevector(v, v, 8, 9, 10, 11, 12, 13, 14, 15) : __builtin_shufflevector(v, v, 0, 1, 2, 3, 4, 5, 6, 7);
 }
+#endif
 
-WASM_EXPORT void set_height(int height)
+/* coefficients kernel[i .. i+3] of a tile, widened from int16 if compact. Float kernels are 16 byte aligned. */
+static ALWAYS_INLINE WASM_SIMD_FUNCTION float32x4 kernel_load4(const void *kernel, int i, int compact)
 {
-    cqt.height = (height > MAX_HEIGHT) ? MAX_HEIGHT : (height > 1) ? height : 1;
+    return compact ? __builtin_convertvector(*(const int16x4u *)((const int16_t *) kernel + i), float32x4)
+                   : *(const float32x4 *)((const float *) kernel + i);
 }
 
-#if WASM_SIMD
-WASM_EXPORT WASM_SIMD_FUNCTION int detect_silence(float threshold)
+#if SIMD_WIDTH >= 8
+static ALWAYS_INLINE WASM_SIMD_FUNCTION float32x8 kernel_load8(const void *kernel, int i, int compact)
 {
-    float32x4 threshold4 = { threshold, threshold, threshold, threshold };
-    float32x4 *v0 = (float32x4 *) cqt.input[0];
-    float32x4 *v1 = (float32x4 *) cqt.input[1];
-    int len = cqt.fft_size >> 2;
-    for (int x = 0; x < len; x++)
-        if (__builtin_wasm_any_true_v128(v0[x] * v0[x] + v1[x] * v1[x] > threshold4))
-            return 0;
-    return 1;
+    return compact ? __builtin_convertvector(*(const int16x8u *)((const int16_t *) kernel + i), float32x8)
+                   : *(const float32x8u *)((const float *) kernel + i);
 }
-#else
-WASM_EXPORT int detect_silence(float threshold)
+#endif
+
+#if SIMD_WIDTH >= 16
+static ALWAYS_INLINE WASM_SIMD_FUNCTION float32x16 kernel_load16(const void *kernel, int i, int compact)
 {
-    for (int x = 0; x < cqt.fft_size; x++)
-        if (cqt.input[0][x] * cqt.input[0][x] + cqt.input[1][x] * cqt.input[1][x] > threshold)
-            return 0;
-    return 1;
+    return compact ? __builtin_convertvector(*(const int16x16u *)((const int16_t *) kernel + i), float32x16)
+                   : *(const float32x16u *)((const float *) kernel + i);
 }
 #endif
+
+/* Wider vectors take the 4 coefficients of 2 or 4 adjacent bins at once: bins from b16 up to b8
+ * by 4, then up to b4 by 2, the rest by 1. Their accumulators are split into per bin ones at the end. */
+#define TILE_SPLIT(bins)                                                        \
+    const int b16 = SIMD_WIDTH >= 16 ? (bins) & ~3 : 0;                        \
+    const int b8 = SIMD_WIDTH >= 8 ? b16 + (((bins) - b16) & ~1) : 0;
+
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void cqt_calc_tile(const Complex *buf, int n, const void *kernel, const KernelTile *tile,
+                                                           Complex4 *r, int bins, int compact)
+{
+    TILE_SPLIT(bins)
+    Complex4 v0[TILE_BINS], v1[TILE_BINS];
+    for (int b = 0; b < bins; b++) {
+        v0[b].re = v0[b].im = (float32x4){ 0, 0, 0, 0 };
+        v1[b].re = v1[b].im = (float32x4){ 0, 0, 0, 0 };
+    }
+#if SIMD_WIDTH >= 8
+    Complex8 w0[TILE_BINS/2], w1[TILE_BINS/2];
+    for (int b = b16; b < b8; b += 2) {
+        w0[b/2].re = w0[b/2].im = (float32x8){ 0 };
+        w1[b/2].re = w1[b/2].im = (float32x8){ 0 };
+    }
+#endif
+#if SIMD_WIDTH >= 16
+    Complex16 z0[TILE_BINS/4], z1[TILE_BINS/4];
+    for (int b = 0; b < b16; b += 4) {
+        z0[b/4].re = z0[b/4].im = (float32x16){ 0 };
+        z1[b/4].re = z1[b/4].im = (float32x16){ 0 };
+    }
+#endif
+
+    for (int m = 0, i = tile->start, j = n - tile->start - 3, o = 0; m < tile->len; m += 4, i += 4, j -= 4, o += 4 * bins) {
+        Complex4 vi = c4_load_uc(buf + i);
+        Complex4 vj = c4_load_uc_reverse(buf + j);
+        Complex4 p = { vi.re + vj.re, vi.im - vj.im };
+        Complex4 q = { vi.im + vj.im, vj.re - vi.re };
+#if SIMD_WIDTH >= 16
+        for (int b = 0; b < b16; b += 4) {
+            float32x16 u = kernel_load16(kernel, o + 4 * b, compact);
+            z0[b/4].re += u * f16_dup(p.re);
+            z0[b/4].im += u * f16_dup(p.im);
+            z1[b/4].re += u * f16_dup(q.re);
+            z1[b/4].im += u * f16_dup(q.im);
+        }
+#endif
+#if SIMD_WIDTH >= 8
+        for (int b = b16; b < b8; b += 2) {
+            float32x8 u = kernel_load8(kernel, o + 4 * b, compact);
+            w0[b/2].re += u * f8_dup(p.re);
+            w0[b/2].im += u * f8_dup(p.im);
+            w1[b/2].re += u * f8_dup(q.re);
+            w1[b/2].im += u * f8_dup(q.im);
+        }
+#endif
+        for (int b = b8; b < bins; b++) {
+            float32x4 u = kernel_load4(kernel, o + 4 * b, compact);
+            v0[b].re += u * p.re;
+            v0[b].im += u * p.im;
+            v1[b].re += u * q.re;
+            v1[b].im += u * q.im;
+        }
+    }
+
+#if SIMD_WIDTH >= 16
+    for (int b = 0; b < b16; b += 4) {
+        for (int k = 0; k < 2; k++) {
+            w0[b/2+k] = (Complex8){ f16_half(z0[b/4].re, k), f16_half(z0[b/4].im, k) };
+            w1[b/2+k] = (Complex8){ f16_half(z1[b/4].re, k), f16_half(z1[b/4].im, k) };
+        }
+    }
+#endif
+#if SIMD_WIDTH >= 8
+    for (int b = 0; b < b8; b += 2) {
+        for (int k = 0; k < 2; k++) {
+            v0[b+k] = (Complex4){ f8_half(w0[b/2].re, k), f8_half(w0[b/2].im, k) };
+            v1[b+k] = (Complex4){ f8_half(w1[b/2].re, k), f8_half(w1[b/2].im, k) };
+        }
+    }
+#endif
+
+    /* v2[b] is left re, left im, right re, right im of bin b, squared and transposed to 4 bins of each */
+    float32x4 v2[4] = { { 0 }, { 0 }, { 0 }, { 0 } };
+    for (int b = 0; b < bins; b++) {
+        float32x4 v0a = __builtin_shufflevector(v0[b].re, v0[b].im, 0, 2, 4, 6);
+        float32x4 v0b = __builtin_shufflevector(v0[b].re, v0[b].im, 1, 3, 5, 7);
+        float32x4 v0c = v0a + v0b;
+        float32x4 v1a = __builtin_shufflevector(v1[b].re, v1[b].im, 0, 2, 4, 6);
+        float32x4 v1b = __builtin_shufflevector(v1[b].re, v1[b].im, 1, 3, 5, 7);
+        float32x4 v1c = v1a + v1b;
+        float32x4 v2a = __builtin_shufflevector(v0c, v1c, 0, 2, 4, 6);
+        float32x4 v2b = __builtin_shufflevector(v0c, v1c, 1, 3, 5, 7);
+        v2[b] = v2a + v2b;
+        v2[b] *= v2[b];
+    }
+    f4_transpose(v2);
+    *r = (Complex4){ v2[0] + v2[1], v2[2] + v2[3] };
+}
+
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void cqt_calc_tile_mono(const Complex *buf, const void *kernel, const KernelTile *tile,
+                                                                float32x4 *r, int bins, int compact)
+{
+    TILE_SPLIT(bins)
+    Complex4 a[TILE_BINS];
+    for (int b = 0; b < bins; b++)
+        a[b].re = a[b].im = (float32x4){ 0, 0, 0, 0 };
+#if SIMD_WIDTH >= 8
+    Complex8 w[TILE_BINS/2];
+    for (int b = b16; b < b8; b += 2)
+        w[b/2].re = w[b/2].im = (float32x8){ 0 };
+#endif
+#if SIMD_WIDTH >= 16
+    Complex16 z[TILE_BINS/4];
+    for (int b = 0; b < b16; b += 4)
+        z[b/4].re = z[b/4].im = (float32x16){ 0 };
+#endif
+
+    for (int m = 0, i = tile->start, o = 0; m < tile->len; m += 4, i += 4, o += 4 * bins) {
+        Complex4 vi = c4_load_uc(buf + i);
+#if SIMD_WIDTH >= 16
+        for (int b = 0; b < b16; b += 4) {
+            float32x16 u = kernel_load16(kernel, o + 4 * b, compact);
+            z[b/4].re += u * f16_dup(vi.re);
+            z[b/4].im += u * f16_dup(vi.im);
+        }
+#endif
+#if SIMD_WIDTH >= 8
+        for (int b = b16; b < b8; b += 2) {
+            float32x8 u = kernel_load8(kernel, o + 4 * b, compact);
+            w[b/2].re += u * f8_dup(vi.re);
+            w[b/2].im += u * f8_dup(vi.im);
+        }
+#endif
+        for (int b = b8; b < bins; b++) {
+            float32x4 u = kernel_load4(kernel, o + 4 * b, compact);
+            a[b].re += u * vi.re;
+            a[b].im += u * vi.im;
+        }
+    }
+
+#if SIMD_WIDTH >= 16
+    for (int b = 0; b < b16; b += 4)
+        for (int k = 0; k < 2; k++)
+            w[b/2+k] = (Complex8){ f16_half(z[b/4].re, k), f16_half(z[b/4].im, k) };
+#endif
+#if SIMD_WIDTH >= 8
+    for (int b = 0; b < b8; b += 2)
+        for (int k = 0; k < 2; k++)
+            a[b+k] = (Complex4){ f8_half(w[b/2].re, k), f8_half(w[b/2].im, k) };
+#endif
+
+    /* v[b] is 2 re and 2 im partial sums of bin b, transposed to 4 bins of each */
+    float32x4 v[4] = { { 0 }, { 0 }, { 0 }, { 0 } };
+    for (int b = 0; b < bins; b++)
+        v[b] = __builtin_shufflevector(a[b].re, a[b].im, 0, 1, 4, 5) + __builtin_shufflevector(a[b].re, a[b].im, 2, 3, 6, 7);
+    f4_transpose(v);
+    float32x4 re = v[0] + v[1], im = v[2] + v[3];
+    *r = re*re + im*im;
+}
+#endif
+
+/* the bins count and compact are constants in each case, so the accumulators stay in registers */
+#define CQT_CALC_CASE(func, bins, ...)                                          \
+    case bins: compact ? func(__VA_ARGS__, bins, 1) : func(__VA_ARGS__, bins, 0); break;
+
+/* powers of the bins of a tile, left in re and right in im: one per bin, in the SIMD build one for all of them */
+#if WASM_SIMD
+typedef Complex4 TilePower;
+typedef float32x4 TilePowerMono;
+#else
+typedef Complex TilePower;
+typedef float TilePowerMono;
+#endif
+
+static WASM_SIMD_FUNCTION void cqt_calc(const Complex *buf, int n, const void *kernel, const KernelTile *tile, TilePower *r, int compact)
+{
+    switch (tile->bins) {
+        CQT_CALC_CASE(cqt_calc_tile, 1, buf, n, kernel, tile, r)
+        CQT_CALC_CASE(cqt_calc_tile, 2, buf, n, kernel, tile, r)
+        CQT_CALC_CASE(cqt_calc_tile, 3, buf, n, kernel, tile, r)
+        CQT_CALC_CASE(cqt_calc_tile, 4, buf, n, kernel, tile, r)
+    }
+}
+
+static WASM_SIMD_FUNCTION void cqt_calc_mono(const Complex *buf, const void *kernel, const KernelTile *tile, TilePowerMono *r,
+                                             int compact)
+{
+    switch (tile->bins) {
+        CQT_CALC_CASE(cqt_calc_tile_mono, 1, buf, kernel, tile, r)
+        CQT_CALC_CASE(cqt_calc_tile_mono, 2, buf, kernel, tile, r)
+        CQT_CALC_CASE(cqt_calc_tile_mono, 3, buf, kernel, tile, r)
+        CQT_CALC_CASE(cqt_calc_tile_mono, 4, buf, kernel, tile, r)
+    }
+}
+
+/* time of the start of a stage, 0 with timing off */
+static ALWAYS_INLINE double stage_begin(const ShowCQT *cqt)
+{
+    return cqt->timing ? clock_ms() : 0;
+}
+
+/* adds the ms since t to stage if timing is on, returns the start of the next stage */
+static ALWAYS_INLINE double stage_end(ShowCQT *cqt, int stage, double t)
+{
+    if (!cqt->timing)
+        return 0;
+    double now = clock_ms();
+    cqt->stage_time[stage] += now - t;
+    return now;
+}
+
+/* x[i] of the input of an n point fft: src[i] if src is set, else samples of the input ring from shift,
+ * the first n/2 as they are, then attack_size windowed by attack_tbl up to the newest sample and zeros.
+ * in[] is the ring of fft_size samples starting at in_pos, see push_samples(), or a calc_batch() span
+ * with in_mask -1, indices never go past in_pos + fft_size. Mono packs samples 2i and 2i+1 into re and im
+ * of a half size fft. */
+#if !WASM_SIMD
+static ALWAYS_INLINE Complex fft_load(const ShowCQT *cqt, const Complex *src, int mono, int shift, int n, int i)
+{
+    if (src)
+        return src[i];
+
+    const float *attack = cqt->tables->attack_tbl;
+    int mask = cqt->in_mask, a = (i - (n >> 1)) << mono;
+    if (a >= cqt->attack_size)
+        return (Complex){0,0};
+
+    Complex c;
+    if (mono) {
+        int k = (shift + 2 * i) & mask;
+        c = (Complex){ cqt->in[0][k], cqt->in[0][(k + 1) & mask] };
+    } else {
+        int k = (shift + i) & mask;
+        c = (Complex){ cqt->in[0][k], cqt->in[1][k] };
+    }
+    if (a >= 0) {
+        c.re *= attack[a];
+        c.im = a + mono < cqt->attack_size ? attack[a + mono] * c.im : 0.0f;
+    }
+    return c;
+}
+
+#else
+static ALWAYS_INLINE WASM_SIMD_FUNCTION Complex4 fft_load(const ShowCQT *cqt, const Complex *src, int mono, int shift,
+                                                          int n, int i)
+{
+    if (src)
+        return c4_load_uc(src + i);
+
+    const float *attack = cqt->tables->attack_tbl;
+    const float *in0 = cqt->in[0], *in1 = cqt->in[1];
+    int mask = cqt->in_mask, size = cqt->attack_size, a = (i - (n >> 1)) << mono;
+    if (a >= size)
+        return (Complex4){ {0}, {0} };
+
+    /* contiguous unless the 4 samples wrap around the ring */
+    Complex4 c;
+    if (mono) {
+        int k = (shift + 2 * i) & mask;
+        if (((k + 7) & mask) == k + 7)
+            c = c4_load_uc((const Complex *)(in0 + k));
+        else
+            for (int m = 0; m < 4; m++)
+                c.re[m] = in0[(k + 2*m) & mask], c.im[m] = in0[(k + 2*m + 1) & mask];
+    } else {
+        int k = (shift + i) & mask;
+        if (((k + 3) & mask) == k + 3)
+            c = (Complex4){ *(const float32x4u *)(in0 + k), *(const float32x4u *)(in1 + k) };
+        else
+            for (int m = 0; m < 4; m++)
+                c.re[m] = in0[(k + m) & mask], c.im[m] = in1[(k + m) & mask];
+    }
+    if (a < 0)
+        return c;
+
+    Complex4 w;
+    if (a + (4 << mono) <= size) {
+        w = mono ? c4_load_uc((const Complex *)(attack + a)) : (Complex4){ *(const float32x4u *)(attack + a),
+                                                                           *(const float32x4u *)(attack + a) };
+    } else {
+        for (int m = 0, b = a; m < 4; m++, b += 1 << mono) {
+            w.re[m] = b < size ? attack[b] : 0.0f;
+            w.im[m] = b + mono < size ? attack[b + mono] : 0.0f;
+        }
+    }
+    return (Complex4){ w.re * c.re, w.im * c.im };
+}
+
+#endif
+
+/* ring offset of sample 0 of the window of an n point fft (n = fft_size, fft_size/4 for the multires short
+ * window, fft_size/2 for mono), whose attack ends at the newest sample */
+static ALWAYS_INLINE int fft_shift(const ShowCQT *cqt, int n)
+{
+    return cqt->fft_size - ((n << cqt->mono) >> 1) - cqt->attack_size + cqt->in_pos;
+}
+
+/* columns [c0, c1) of an n point fft of fft_load() into fft_tmp, multiples of FFT_COLS. The columns of a
+ * block are loaded together, they take one cache line of each input row. */
+#define FFT_COLS 16
+
+/* FFT_COLS points of fft_load() from i, its checks done once for all of them */
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void fft_load_cols(const ShowCQT *cqt, const Complex *src, int shift, int n, int i,
+                                                           FFTLane *v)
+{
+    int mono = cqt->mono, mask = cqt->in_mask, a = (i - (n >> 1)) << mono, w = FFT_COLS << mono;
+    int k = (shift + (i << mono)) & mask;
+    if (!src && a + w <= 0 && ((k + w - 1) & mask) == k + w - 1) {
+        const float *in0 = cqt->in[0] + k, *in1 = cqt->in[1] + k;
+        for (int g = 0; g < FFT_COLS / FFT_LANES; g++) {
+#if WASM_SIMD
+            v[g] = mono ? c4_load_uc((const Complex *)(in0 + 8*g))
+                        : (Complex4){ *(const float32x4u *)(in0 + 4*g), *(const float32x4u *)(in1 + 4*g) };
+#else
+            v[g] = mono ? (Complex){ in0[2*g], in0[2*g+1] } : (Complex){ in0[g], in1[g] };
+#endif
+        }
+        return;
+    }
+    if (!src && a >= cqt->attack_size) {
+        for (int g = 0; g < FFT_COLS / FFT_LANES; g++)
+            v[g] = (FFTLane){ 0 };
+        return;
+    }
+    for (int g = 0; g < FFT_COLS / FFT_LANES; g++)
+        v[g] = fft_load(cqt, src, mono, shift, n, i + g * FFT_LANES);
+}
+
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void fft_cols_n(ShowCQT *cqt, const Complex *src, int n, int n2,
+                                                        const Complex *tbl, int c0, int c1)
+{
+    FFTLane a[FFT_COLS / FFT_LANES][FFT_LANE_SIZE / 2], b[FFT_LANE_SIZE / 2];
+    int n1 = n / n2, q = n2 >> 2, ns = fft_last_ns(n2), ys = n2 + FFT_PAD;
+    int shift = fft_shift(cqt, n);
+    const Complex *e = tbl + n;
+    Complex *y = cqt->fft_tmp;
+
+    for (int c = c0; c < c1; c += FFT_COLS) {
+        for (int j = 0; j < q; j++) {
+            FFTLane v[4][FFT_COLS / FFT_LANES];
+            for (int r = 0; r < 4; r++)
+                fft_load_cols(cqt, src, shift, n, c + n1 * (j + r*q), v[r]);
+            for (int g = 0; g < FFT_COLS / FFT_LANES; g++)
+                fft_dft4((FFTLane[4]){ v[0][g], v[1][g], v[2][g], v[3][g] }, a[g] + 4*j, 1);
+        }
+
+        for (int g = 0; g < FFT_COLS / FFT_LANES; g++) {
+            int i1 = c + g * FFT_LANES;
+            const FFTLane *p = fft_lanes(a[g], b, n2, e);
+            const Complex *w = tbl + i1 * n2;
+#if WASM_SIMD
+            /* y holds 4 complex as 4 re and 4 im, 4 butterflies give 4 points of each row */
+            for (int j = 0; j < ns; j += 4) {
+                Complex4 v[4][4], t[4];
+                for (int m = 0; m < 4; m++)
+                    fft_lanes_last(p, n2, ns, j + m, e, v[m]);
+                for (int r = 0; r < n2 / ns; r++) {
+                    int k2 = j + r*ns;
+                    for (int m = 0; m < 4; m++)
+                        t[m] = c4_mul(c4_load_c(w + 4 * (k2+m), 0), v[m][r]);
+                    c4_transpose(t);
+                    for (int m = 0; m < 4; m++)
+                        c4_store_c(y + (i1+m)*ys + k2, t[m], 0);
+                }
+            }
+#else
+            for (int j = 0; j < ns; j++) {
+                Complex v[4];
+                fft_lanes_last(p, n2, ns, j, e, v);
+                for (int r = 0; r < n2 / ns; r++)
+                    y[i1*ys + j + r*ns] = C_MUL(w[j + r*ns], v[r]);
+            }
+#endif
+        }
+    }
+}
+
+/* the common sizes with a constant n2, for the loops of fft_lanes() */
+static WASM_SIMD_FUNCTION OPTIMIZE_LOOPS void fft_cols(ShowCQT *cqt, const Complex *src, int n, const Complex *tbl, int c0, int c1)
+{
+    switch (fft_n2(n)) {
+    case 16:    fft_cols_n(cqt, src, n, 16, tbl, c0, c1);  break;
+    case 64:    fft_cols_n(cqt, src, n, 64, tbl, c0, c1);  break;
+    case 128:   fft_cols_n(cqt, src, n, 128, tbl, c0, c1); break;
+    default:    fft_cols_n(cqt, src, n, fft_n2(n), tbl, c0, c1);
+    }
+}
+
+/* rows [r0, r1) of an n point fft from fft_tmp into fft_buf, multiples of FFT_ROWS. They run as two groups
+ * of FFT_LANES, which fill each cache line of X that they write. */
+#define FFT_ROWS (2 * FFT_LANES)
+
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void fft_rows_n(ShowCQT *cqt, int n, int n1, const Complex *tbl, int r0, int r1)
+{
+    FFTLane a[FFT_LANE_SIZE], b[FFT_LANE_SIZE], c[FFT_LANE_SIZE];
+    int n2 = n / n1, q = n1 >> 2, ns = fft_last_ns(n1), ys = n2 + FFT_PAD;
+    const Complex *y = cqt->fft_tmp, *e = tbl + n + n2;
+    Complex *x = cqt->fft_buf;
+
+    for (int k2 = r0; k2 < r1; k2 += FFT_ROWS) {
+        for (int j = 0; j < q; j++) {
+            FFTLane v[4], u[4];
+            for (int r = 0; r < 4; r++) {
+                v[r] = fft_lane_load(y + (j + r*q)*ys + k2);
+                u[r] = fft_lane_load(y + (j + r*q)*ys + k2 + FFT_LANES);
+            }
+            fft_dft4(v, a + 4*j, 1);
+            fft_dft4(u, c + 4*j, 1);
+        }
+
+        const FFTLane *p = fft_lanes(a, b, n1, e);
+        const FFTLane *o = fft_lanes(c, p == a ? b : a, n1, e);
+        for (int j = 0; j < ns; j++) {
+            FFTLane v[4], u[4];
+            fft_lanes_last(p, n1, ns, j, e, v);
+            fft_lanes_last(o, n1, ns, j, e, u);
+            for (int r = 0; r < n1 / ns; r++) {
+                fft_lane_store(x + k2 + n2*(j + r*ns), v[r]);
+                fft_lane_store(x + k2 + FFT_LANES + n2*(j + r*ns), u[r]);
+            }
+        }
+    }
+}
+
+static WASM_SIMD_FUNCTION OPTIMIZE_LOOPS void fft_rows(ShowCQT *cqt, int n, const Complex *tbl, int r0, int r1)
+{
+    switch (n / fft_n2(n)) {
+    case 64:    fft_rows_n(cqt, n, 64, tbl, r0, r1);  break;
+    case 128:   fft_rows_n(cqt, n, 128, tbl, r0, r1); break;
+    case 256:   fft_rows_n(cqt, n, 256, tbl, r0, r1); break;
+    default:    fft_rows_n(cqt, n, n / fft_n2(n), tbl, r0, r1);
+    }
+}
+
+/* n point fft of fft_load() into fft_buf, the columns end the input stage begun at *time */
+static WASM_SIMD_FUNCTION void fft_calc(ShowCQT *cqt, const Complex *src, int n, const Complex *tbl, double *time)
+{
+    int n2 = fft_n2(n);
+    fft_cols(cqt, src, n, tbl, 0, n / n2);
+    *time = stage_end(cqt, STAGE_INPUT, *time);
+    fft_rows(cqt, n, tbl, 0, n2);
+}
+
+/* Half-band lowpass for the multires long window, y[m] = x[2m] + sum dec_coef[k] * (x[2m-2k-1] + x[2m+2k+1]).
+ * Kaiser windowed, passband up to fs/8 and stopband from 3fs/8 at about -98dB, dc gain 2 so that
+ * the n/2 point fft of y matches the n point fft of x below fs/8. */
+static const float dec_coef[DEC_TAPS] = {
+    0.621380978f, -0.170264913f, 0.068192761f, -0.025652105f, 0.007818343f, -0.001637805f, 0.000153481f
+};
+
+/* A signal x is stored as its even and odd phases, x[base+2i] = e[i] and x[base+2i+1] = o[i] for i in
+ * [0, len), each phase padded with DEC_PAD zeros on both sides. dec_phases() returns e, o is e + len + 2*DEC_PAD. */
+static Complex *dec_phases(Complex *p, int len)
+{
+    for (int x = 0; x < DEC_PAD; x++) {
+        p[x] = p[DEC_PAD+len+x] = (Complex){0,0};
+        p[2*DEC_PAD+len+x] = p[3*DEC_PAD+2*len+x] = (Complex){0,0};
+    }
+    return p + DEC_PAD;
+}
+
+/* one stage from the phases of x at src into the phases of y at dst, returns the length of y's phases */
+static WASM_SIMD_FUNCTION int dec_stage(const Complex *src, int len, int *base, Complex *dst)
+{
+    int b = *base >> 1;
+    int m0 = (b - DEC_TAPS + 1) & ~1;
+    int len_y = (b + len + DEC_TAPS - m0 + 1) >> 1;
+    const Complex *e = src, *o = src + len + 2 * DEC_PAD;
+    Complex *ye = dec_phases(dst, len_y), *yo = ye + len_y + 2 * DEC_PAD;
+
+    /* y[m0+2i] and y[m0+2i+1] from x[2m0+4i-13 .. 2m0+4i+15] */
+    for (int i = 0, j = m0 - b; i < len_y; i++, j += 2) {
+#if WASM_SIMD
+        float32x4 v = *(const float32x4u *)(e + j);
+        for (int k = 0; k < DEC_TAPS; k++)
+            v += dec_coef[k] * (*(const float32x4u *)(o + j - k - 1) + *(const float32x4u *)(o + j + k));
+        ye[i] = (Complex){ v[0], v[1] };
+        yo[i] = (Complex){ v[2], v[3] };
+#else
+        Complex v0 = e[j], v1 = e[j+1];
+        for (int k = 0; k < DEC_TAPS; k++) {
+            v0.re += dec_coef[k] * (o[j-k-1].re + o[j+k].re);
+            v0.im += dec_coef[k] * (o[j-k-1].im + o[j+k].im);
+            v1.re += dec_coef[k] * (o[j-k].re + o[j+k+1].re);
+            v1.im += dec_coef[k] * (o[j-k].im + o[j+k+1].im);
+        }
+        ye[i] = v0;
+        yo[i] = v1;
+#endif
+    }
+
+    *base = m0;
+    return len_y;
+}
+
+/* Multires long window: the windowed input of the full fft, decimated dec_bits times and stored in natural
+ * order as the input of the fft_size >> dec_bits point fft, center at n/2. Returns it, somewhere in fft_buf. */
+static WASM_SIMD_FUNCTION Complex *calc_input_dec(ShowCQT *cqt)
+{
+    const ShowCQTTables *t = cqt->tables;
+    int h = cqt->fft_size >> 1;
+    int n = cqt->fft_size >> t->dec_bits;
+    int shift = h - cqt->attack_size + cqt->in_pos;
+    int mask = cqt->in_mask;
+    int len = (h + cqt->attack_size + 1) >> 1, base = 0;
+    const float *in0 = cqt->in[0], *in1 = cqt->in[1];
+    Complex *src = cqt->fft_buf, *dst = cqt->fft_buf + 2 * (len + 2 * DEC_PAD);
+    Complex *e = dec_phases(src, len), *o = e + len + 2 * DEC_PAD;
+
+    for (int x = 0; x < h >> 1; x++) {
+        int k0 = (shift + 2*x) & mask, k1 = (shift + 2*x + 1) & mask;
+        e[x] = (Complex){ in0[k0], in1[k0] };
+        o[x] = (Complex){ in0[k1], in1[k1] };
+    }
+
+    for (int x = h; x < h + cqt->attack_size; x++) {
+        int k = (shift + x) & mask;
+        float w = t->attack_tbl[x-h];
+        Complex *p = (x & 1) ? o : e;
+        p[x>>1] = (Complex){ w * in0[k], w * in1[k] };
+    }
+    if (2 * len > h + cqt->attack_size)
+        o[len-1] = (Complex){0,0};
+
+    /* ping-pong between the first stage's input and the space after it */
+    for (int s = 0; s < t->dec_bits; s++) {
+        Complex *next = src;
+        len = dec_stage(src + DEC_PAD, len, &base, dst);
+        src = dst;
+        dst = next;
+    }
+
+    e = src + DEC_PAD;
+    o = e + len + 2 * DEC_PAD;
+    for (int x = 0; x < n; x++) {
+        int m = (x - base) & (n - 1);
+        Complex *p = (m & 1) ? o : e;
+        dst[x] = m < 2 * len ? p[m>>1] : (Complex){0,0};
+    }
+    return dst;
+}
+
+/* Split the half size fft of the packed mono input into bins 0..fft_size/2 (and the mirrored
+ * bins past nyquist read by the kernel) of the real fft, scaled by 2 to match the stereo path.
+ * Pairs (k, fft_size/2 - k) for k in [k0, k1). */
+static void calc_rfft_split(ShowCQT *cqt, int k0, int k1)
+{
+    int h = cqt->fft_size >> 1;
+    int ext = cqt->tables->rfft_ext;
+    Complex *v = cqt->fft_buf;
+    const Complex *w = cqt->tables->rfft_tbl;
+
+    if (!k0) {
+        Complex z0 = v[0], zq = v[h>>1];
+        v[0] = (Complex){ 2 * (z0.re + z0.im), 0 };
+        v[h] = (Complex){ 2 * (z0.re - z0.im), 0 };
+        v[h>>1] = (Complex){ 2 * zq.re, -2 * zq.im };
+        k0 = 1;
+    }
+
+    for (int k = k0; k < k1; k++) {
+        Complex z0 = v[k], z1 = v[h-k];
+        Complex a = { z0.re + z1.re, z0.im - z1.im };
+        Complex b = { z0.im + z1.im, z1.re - z0.re };
+        Complex c = C_MUL(w[k], b);
+        v[k] = C_ADD(a, c);
+        v[h-k] = (Complex){ a.re - c.re, c.im - a.im };
+        if (k < ext)
+            v[h+k] = C_SUB(a, c);
+    }
+}
+
+#if WASM_SIMD
+/* correctly rounded as sqrtf(), so the colors do not depend on the build */
+static ALWAYS_INLINE WASM_SIMD_FUNCTION float32x4 f4_sqrt(float32x4 v)
+{
+#if SHOWCQT_NATIVE
+    return __builtin_ia32_sqrtps(v);
+#else
+    return __builtin_wasm_sqrt_f32x4(v);
+#endif
+}
+
+/* r, g, b and h of 4 bins into the first bins colors */
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void color_store(ColorF *color, float32x4 r, float32x4 g, float32x4 b, float32x4 h,
+                                                         int bins)
+{
+    float32x4 v[4] = { r, g, b, h };
+    f4_transpose(v);
+    for (int k = 0; k < bins; k++)
+        *(float32x4 *)(color + k) = v[k];
+}
+
+/* kernel_scale of compact, squared as the powers */
+static ALWAYS_INLINE WASM_SIMD_FUNCTION float32x4 power_scale(const ShowCQTTables *t, const KernelTile *tile)
+{
+    float32x4 s = { 0 };
+    for (int b = 0; b < tile->bins; b++)
+        s[b] = t->kernel_scale[tile->x + b] * t->kernel_scale[tile->x + b];
+    return s;
+}
+#endif
+
+/* offset is the index of the coefficients of tile k0, buf holds the output of an n point fft */
+static WASM_SIMD_FUNCTION void calc_kernel(ShowCQT *cqt, const Complex *buf, int n, int k0, int k1, int offset)
+{
+    const ShowCQTTables *t = cqt->tables;
+
+    for (int k = k0; k < k1; k++) {
+        const KernelTile *tile = &t->tiles[k];
+        ColorF *color = cqt->color_buf + tile->x;
+        const void *kernel = t->compact ? (const void *)(t->kernel16 + offset) : (const void *)(t->kernel + offset);
+
+#if WASM_SIMD
+        if (cqt->mono) {
+            float32x4 r;
+            cqt_calc_mono(buf, kernel, tile, &r, t->compact);
+            if (t->compact)
+                r *= power_scale(t, tile);
+            float32x4 h = f4_sqrt(r), c = f4_sqrt(cqt->sono_v * h);
+            color_store(color, cqt->palette.r * c, cqt->palette.g * c, cqt->palette.b * c, cqt->bar_v * h, tile->bins);
+        } else {
+            Complex4 r;
+            cqt_calc(buf, n, kernel, tile, &r, t->compact);
+            if (t->compact) {
+                float32x4 s = power_scale(t, tile);
+                r = (Complex4){ s * r.re, s * r.im };
+            }
+            float32x4 h = f4_sqrt(0.5f * (r.re + r.im));
+            color_store(color, f4_sqrt(cqt->sono_v * f4_sqrt(r.re)), f4_sqrt(cqt->sono_v * h),
+                        f4_sqrt(cqt->sono_v * f4_sqrt(r.im)), cqt->bar_v * h, tile->bins);
+        }
+#else
+        if (cqt->mono) {
+            float r[TILE_BINS];
+            cqt_calc_mono(buf, kernel, tile, r, t->compact);
+            for (int b = 0; t->compact && b < tile->bins; b++)
+                r[b] *= t->kernel_scale[tile->x + b] * t->kernel_scale[tile->x + b];
+            for (int b = 0; b < tile->bins; b++) {
+                float c = sqrtf(cqt->sono_v * sqrtf(r[b]));
+                color[b].r = cqt->palette.r * c;
+                color[b].g = cqt->palette.g * c;
+                color[b].b = cqt->palette.b * c;
+                color[b].h = cqt->bar_v * sqrtf(r[b]);
+            }
+        } else {
+            Complex r[TILE_BINS];
+            cqt_calc(buf, n, kernel, tile, r, t->compact);
+            for (int b = 0; t->compact && b < tile->bins; b++) {
+                float s = t->kernel_scale[tile->x + b] * t->kernel_scale[tile->x + b];
+                r[b] = (Complex){ s * r[b].re, s * r[b].im };
+            }
+            for (int b = 0; b < tile->bins; b++) {
+                color[b].r = sqrtf(cqt->sono_v * sqrtf(r[b].re));
+                color[b].g = sqrtf(cqt->sono_v * sqrtf(0.5f * (r[b].re + r[b].im)));
+                color[b].b = sqrtf(cqt->sono_v * sqrtf(r[b].im));
+                color[b].h = cqt->bar_v * sqrtf(0.5f * (r[b].re + r[b].im));
+            }
+        }
+#endif
+
+        offset += tile_size(tile);
+    }
+}
+
+/* a marker rises with its bar, stays hold frames, then falls by fall per frame down to the bar */
+static ALWAYS_INLINE void peak_update(float *peak, float *hold, float h, float hold_frames, float fall)
+{
+    h = h > 0.0f ? h : 0.0f;
+    if (h >= *peak) {
+        *peak = h;
+        *hold = hold_frames;
+    } else if (*hold > 0.0f) {
+        *hold -= 1.0f;
+    } else {
+        *peak = *peak - fall > h ? *peak - fall : h;
+    }
+}
+
+#if WASM_SIMD
+/* one ColorF is one float32x4, rising components take attack, falling ones decay */
+static WASM_SIMD_FUNCTION void calc_smooth(ShowCQT *cqt)
+{
+    float32x4 attack = (float32x4){0} + cqt->attack;
+    float32x4 decay = (float32x4){0} + cqt->decay;
+    float32x4 hold_frames = (float32x4){0} + cqt->peak_hold;
+    float32x4 fall = (float32x4){0} + cqt->peak_fall;
+    float32x4 zero = {0}, one = (float32x4){0} + 1.0f;
+    int x = 0;
+
+    for (int k = 0; cqt->smooth && k < cqt->width; k++) {
+        float32x4 c = *(float32x4 *)(cqt->color_buf + k);
+        float32x4 s = *(float32x4 *)(cqt->smooth_buf + k);
+        int32x4 up = c > s;
+        float32x4 m = (float32x4)(((int32x4) attack & up) | ((int32x4) decay & ~up));
+        s += m * (c - s);
+        *(float32x4 *)(cqt->color_buf + k) = s;
+        *(float32x4 *)(cqt->smooth_buf + k) = s;
+    }
+
+    for (; cqt->peak && x + 4 <= cqt->width; x += 4) {
+        const ColorF *c = cqt->color_buf + x;
+        float32x4 h = { c[0].h, c[1].h, c[2].h, c[3].h };
+        float32x4 peak = *(float32x4 *)(cqt->peak_buf + x);
+        float32x4 hold = *(float32x4 *)(cqt->hold_buf + x);
+        h = (float32x4)((int32x4) h & (h > zero));
+        int32x4 rise = h >= peak;
+        int32x4 wait = ~rise & (hold > zero);
+        int32x4 drop = ~rise & ~wait;
+        float32x4 fallen = peak - fall;
+        fallen = (float32x4)(((int32x4) fallen & (fallen > h)) | ((int32x4) h & ~(fallen > h)));
+        peak = (float32x4)(((int32x4) h & rise) | ((int32x4) fallen & drop) | ((int32x4) peak & wait));
+        hold = (float32x4)(((int32x4) hold_frames & rise) | ((int32x4)(hold - one) & wait) | ((int32x4) hold & drop));
+        *(float32x4 *)(cqt->peak_buf + x) = peak;
+        *(float32x4 *)(cqt->hold_buf + x) = hold;
+    }
+    for (; cqt->peak && x < cqt->width; x++)
+        peak_update(cqt->peak_buf + x, cqt->hold_buf + x, cqt->color_buf[x].h, cqt->peak_hold, cqt->peak_fall);
+}
+#else
+static void calc_smooth(ShowCQT *cqt)
+{
+    for (int x = 0; cqt->smooth && x < cqt->width; x++) {
+        float *c = (float *)(cqt->color_buf + x), *s = (float *)(cqt->smooth_buf + x);
+        for (int k = 0; k < 4; k++) {
+            s[k] += (c[k] > s[k] ? cqt->attack : cqt->decay) * (c[k] - s[k]);
+            c[k] = s[k];
+        }
+    }
+
+    for (int x = 0; cqt->peak && x < cqt->width; x++)
+        peak_update(cqt->peak_buf + x, cqt->hold_buf + x, cqt->color_buf[x].h, cqt->peak_hold, cqt->peak_fall);
+}
+#endif
+
+static WASM_SIMD_FUNCTION void calc_finish(ShowCQT *cqt)
+{
+    double t = stage_begin(cqt);
+    if (cqt->t_size != cqt->width) {
+        for (int x = 0; x < cqt->width; x++) {
+            cqt->color_buf[x].r = 0.5f * (cqt->color_buf[2*x].r + cqt->color_buf[2*x+1].r);
+            cqt->color_buf[x].g = 0.5f * (cqt->color_buf[2*x].g + cqt->color_buf[2*x+1].g);
+            cqt->color_buf[x].b = 0.5f * (cqt->color_buf[2*x].b + cqt->color_buf[2*x+1].b);
+            cqt->color_buf[x].h = 0.5f * (cqt->color_buf[2*x].h + cqt->color_buf[2*x+1].h);
+        }
+    }
+
+    if (cqt->smooth || cqt->peak)
+        calc_smooth(cqt);
+    stage_end(cqt, STAGE_FINISH, t);
+    cqt->prerender = PRERENDER_COLORS;
+}
+
+#if WASM_THREADS
+/* Thread pool for calc(). Thread 0 is the caller, threads 1..threads-1 are workers
+ * parked in worker_run(). The caller may be the browser main thread, which cannot
+ * block, so the caller and the stage barriers spin. */
+#define MAX_THREADS 16
+
+static struct {
+    int         threads;
+    int         ready;
+    int         generation;
+    int         arrived;
+    int         phase;
+    ShowCQT     *cqt;
+    const Complex *src; /* multires: the decimated long window */
+} pool = { 1 };
+
+#define pool_load(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define pool_store(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define pool_add(p, v) __atomic_add_fetch(p, v, __ATOMIC_ACQ_REL)
+
+static void pool_barrier(void)
+{
+    int phase = pool_load(&pool.phase);
+    if (pool_add(&pool.arrived, 1) == pool.threads) {
+        pool_store(&pool.arrived, 0);
+        pool_store(&pool.phase, phase + 1);
+    } else {
+        while (pool_load(&pool.phase) == phase);
+    }
+}
+
+static ALWAYS_INLINE int pool_split(int n, int index)
+{
+    return (int64_t) n * index / pool.threads;
+}
+
+/* n point fft_calc() of src, the columns and rows split by blocks, so the result is bit identical */
+static void fft_part(ShowCQT *cqt, const Complex *src, int n, const Complex *tbl, int index, double *time)
+{
+    int cols = n / fft_n2(n) / FFT_COLS, rows = fft_n2(n) / FFT_ROWS;
+    fft_cols(cqt, src, n, tbl, FFT_COLS * pool_split(cols, index), FFT_COLS * pool_split(cols, index + 1));
+    pool_barrier();
+    if (!index)
+        *time = stage_end(cqt, STAGE_INPUT, *time);
+    fft_rows(cqt, n, tbl, FFT_ROWS * pool_split(rows, index), FFT_ROWS * pool_split(rows, index + 1));
+    pool_barrier();
+}
+
+/* tiles [x, x1) of size kernel coefficients from offset, split by kernel length */
+static void kernel_part(ShowCQT *cqt, int n, int x, int x1, int offset, int size, int index)
+{
+    const ShowCQTTables *t = cqt->tables;
+    int k0 = offset + pool_split(size, index), k1 = offset + pool_split(size, index + 1);
+    int k = offset, x0;
+    while (x < x1 && k < k0)
+        k += tile_size(&t->tiles[x++]);
+    x0 = x;
+    offset = k;
+    while (x < x1 && k < k1)
+        k += tile_size(&t->tiles[x++]);
+    if (index == pool.threads - 1)
+        x = x1;
+    calc_kernel(cqt, cqt->fft_buf, n, x0, x, offset);
+    pool_barrier();
+}
+
+/* the caller (index 0) times the stages, from barrier to barrier, in the order of calc_frame() */
+static void calc_part(ShowCQT *cqt, int index)
+{
+    const ShowCQTTables *t = cqt->tables;
+    double time = index ? 0 : stage_begin(cqt);
+
+    /* multires: the caller decimates the long window into fft_buf, the others wait for its columns */
+    if (t->split) {
+        int n = cqt->fft_size >> t->dec_bits;
+        const Complex *src = 0;
+        if (!index && t->dec_bits)
+            pool.src = calc_input_dec(cqt);
+        if (t->dec_bits) {
+            pool_barrier();
+            src = pool.src;
+        }
+        fft_part(cqt, src, n, t->exp_tbl1, index, &time);
+        if (!index)
+            time = stage_end(cqt, STAGE_FFT, time);
+        kernel_part(cqt, n, 0, t->split_tile, 0, t->split_offset, index);
+        if (!index)
+            time = stage_end(cqt, STAGE_KERNEL, time);
+    }
+
+    int n = fft0_size(cqt->fft_size, cqt->mono, cqt->multires);
+    fft_part(cqt, 0, n, t->exp_tbl, index, &time);
+    if (cqt->mono) {
+        calc_rfft_split(cqt, pool_split(n >> 1, index), pool_split(n >> 1, index + 1));
+        pool_barrier();
+    }
+    if (!index)
+        time = stage_end(cqt, STAGE_FFT, time);
+
+    kernel_part(cqt, n, t->split_tile, t->tile_count, t->split_offset, t->kernel_size - t->split_offset, index);
+    if (!index)
+        stage_end(cqt, STAGE_KERNEL, time);
+}
+
+WASM_EXPORT void worker_run(int index)
+{
+    int generation = pool_load(&pool.generation);
+    pool_add(&pool.ready, 1);
+
+    while (1) {
+        __builtin_wasm_memory_atomic_wait32(&pool.generation, generation, -1);
+        int g = pool_load(&pool.generation);
+        if (g == generation)
+            continue;
+        generation = g;
+        if (index < pool.threads)
+            calc_part(pool.cqt, index);
+    }
+}
+
+/* number of workers parked in worker_run() */
+WASM_EXPORT int pool_ready(void)
+{
+    return pool_load(&pool.ready);
+}
+
+WASM_EXPORT int pool_set_threads(int threads)
+{
+    int ready = pool_load(&pool.ready);
+    threads = threads < 1 ? 1 : threads > MAX_THREADS ? MAX_THREADS : threads;
+    pool.threads = threads > ready + 1 ? ready + 1 : threads;
+    return pool.threads;
+}
+#endif
+
+static WASM_SIMD_FUNCTION void calc_frame(ShowCQT *cqt)
+{
+#if WASM_THREADS
+    if (pool.threads > 1) {
+        pool.cqt = cqt;
+        pool_add(&pool.generation, 1);
+        __builtin_wasm_memory_atomic_notify(&pool.generation, -1);
+        calc_part(cqt, 0);
+        calc_finish(cqt);
+        return;
+    }
+#endif
+
+    const ShowCQTTables *t = cqt->tables;
+    double time = stage_begin(cqt);
+    if (cqt->mono) {
+        fft_calc(cqt, 0, cqt->fft_size >> 1, t->exp_tbl, &time);
+        calc_rfft_split(cqt, 0, cqt->fft_size >> 2);
+        time = stage_end(cqt, STAGE_FFT, time);
+        calc_kernel(cqt, cqt->fft_buf, cqt->fft_size, 0, t->tile_count, 0);
+        stage_end(cqt, STAGE_KERNEL, time);
+        calc_finish(cqt);
+        return;
+    }
+
+    /* multires: bins below split from the decimated long window first, the columns read the decimated
+     * input in fft_buf before the rows write over it */
+    if (t->split) {
+        int n = cqt->fft_size >> t->dec_bits;
+        fft_calc(cqt, t->dec_bits ? calc_input_dec(cqt) : 0, n, t->exp_tbl1, &time);
+        time = stage_end(cqt, STAGE_FFT, time);
+        calc_kernel(cqt, cqt->fft_buf, n, 0, t->split_tile, 0);
+        time = stage_end(cqt, STAGE_KERNEL, time);
+    }
+
+    int n = fft0_size(cqt->fft_size, 0, cqt->multires);
+    fft_calc(cqt, 0, n, t->exp_tbl, &time);
+    time = stage_end(cqt, STAGE_FFT, time);
+    calc_kernel(cqt, cqt->fft_buf, n, t->split_tile, t->tile_count, t->split_offset);
+    stage_end(cqt, STAGE_KERNEL, time);
+    calc_finish(cqt);
+}
+
+/* get_stats() counters, the calls compile to nothing without SHOWCQT_STATS */
+#if SHOWCQT_STATS
+static double stats_clock(void)
+{
+    return clock_ms();
+}
+
+static void stats_call(double *stats, int calls, double t)
+{
+    double time = clock_ms() - t;
+    stats[calls]++;
+    stats[calls + 1] += time;
+    stats[calls + 2] = time > stats[calls + 2] ? time : stats[calls + 2];
+}
+
+static void stats_calc(ShowCQT *cqt, int frames, double t)
+{
+    const ShowCQTTables *tb = cqt->tables;
+    stats_call(cqt->stats, STAT_CALC_CALLS, t);
+    for (int k = 0; k < tb->tile_count; k++) {
+        cqt->stats[STAT_KERNEL_TAPS] += (double) frames * tile_size(&tb->tiles[k]);
+        cqt->stats[STAT_BINS_SKIPPED] += tb->tiles[k].len ? 0 : frames * tb->tiles[k].bins;
+    }
+}
+
+static void stats_prerender(ShowCQT *cqt)
+{
+    cqt->stats[STAT_PRERENDERS]++;
+}
+#else
+static ALWAYS_INLINE double stats_clock(void) { return 0; }
+static ALWAYS_INLINE void stats_calc(ShowCQT *cqt, int frames, double t) { (void) cqt; (void) frames; (void) t; }
+static ALWAYS_INLINE void stats_prerender(ShowCQT *cqt) { (void) cqt; }
+#endif
+
+#if WASM_SIMD
+WASM_EXPORT WASM_SIMD_FUNCTION int detect_silence(ShowCQT *cqt, float threshold)
+{
+    float32x4 threshold4 = { threshold, threshold, threshold, threshold };
+    float32x4 *v0 = (float32x4 *) cqt->input[0];
+    float32x4 *v1 = (float32x4 *) cqt->input[1];
+    int len = cqt->fft_size >> 2;
+    for (int x = 0; x < len; x++)
+        if (any_true(v0[x] * v0[x] + v1[x] * v1[x] > threshold4))
+            return 0;
+    return 1;
+}
+#else
+WASM_EXPORT int detect_silence(ShowCQT *cqt, float threshold)
+{
+    for (int x = 0; x < cqt->fft_size; x++)
+        if (cqt->input[0][x] * cqt->input[0][x] + cqt->input[1][x] * cqt->input[1][x] > threshold)
+            return 0;
+    return 1;
+}
+#endif
+
+/* input_same() is 1 if the input ring is the copy of input_save(), bit for bit, it stops at the first block
+ * that differs */
+#if WASM_SIMD
+static WASM_SIMD_FUNCTION int input_same(const ShowCQT *cqt)
+{
+    int len = cqt->fft_size >> 2;
+    const uint32x4 *last = (const uint32x4 *) cqt->last_input;
+    for (int k = 0; k < 2; k++, last += len) {
+        const uint32x4 *v = (const uint32x4 *) cqt->input[k];
+        for (int x = 0; x < len; x += 4)
+            if (any_true((v[x] ^ last[x]) | (v[x+1] ^ last[x+1]) | (v[x+2] ^ last[x+2]) | (v[x+3] ^ last[x+3])))
+                return 0;
+    }
+    return 1;
+}
+
+static WASM_SIMD_FUNCTION void input_save(ShowCQT *cqt)
+{
+    int len = cqt->fft_size >> 2;
+    uint32x4 *last = (uint32x4 *) cqt->last_input;
+    for (int k = 0; k < 2; k++, last += len)
+        for (int x = 0; x < len; x++)
+            last[x] = ((const uint32x4 *) cqt->input[k])[x];
+}
+#else
+static int input_same(const ShowCQT *cqt)
+{
+    int len = cqt->fft_size;
+    const uint32_t *last = (const uint32_t *) cqt->last_input;
+    for (int k = 0; k < 2; k++, last += len) {
+        const uint32_t *v = (const uint32_t *) cqt->input[k];
+        for (int x = 0; x < len; x += 16) {
+            uint32_t diff = 0;
+            for (int m = 0; m < 16; m++)
+                diff |= v[x+m] ^ last[x+m];
+            if (diff)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+static void input_save(ShowCQT *cqt)
+{
+    int len = cqt->fft_size;
+    uint32_t *last = (uint32_t *) cqt->last_input;
+    for (int k = 0; k < 2; k++, last += len)
+        for (int x = 0; x < len; x++)
+            last[x] = ((const uint32_t *) cqt->input[k])[x];
+}
+#endif
+
+/* With set_skip_static() on, a frame is reused when the input ring and input_pos are the same as
+ * at the previous calc(), or when both inputs are silent. color_buf is left as it is. The ring is
+ * compared with a copy, writers of get_input_array() that leave input_pos are seen too. Changing
+ * input stops both scans early, only a frame that is not reused pays for a full copy. */
+static WASM_SIMD_FUNCTION int calc_reuse(ShowCQT *cqt)
+{
+    /* smoothing and markers move on with the same input */
+    if (cqt->skip_silence < 0 || cqt->smooth || cqt->peak || !cqt->last_input)
+        return 0;
+
+    int same = cqt->last_valid && !cqt->last_silent && cqt->last_pos == cqt->input_pos && input_same(cqt);
+    int silent = !same && detect_silence(cqt, cqt->skip_silence);
+    if (silent)
+        same = cqt->last_valid && cqt->last_silent;
+    else if (!same)
+        input_save(cqt);
+    cqt->last_valid = 1;
+    cqt->last_silent = silent;
+    cqt->last_pos = cqt->input_pos;
+    if (same && !cqt->prerender && cqt->sono_lines)
+        cqt->prerender = PRERENDER_SONO;
+    return same;
+}
+
+/* returns 1 if the previous frame was reused, see set_skip_static() */
+WASM_EXPORT WASM_SIMD_FUNCTION int calc(ShowCQT *cqt)
+{
+    double t = stats_clock();
+    if (calc_reuse(cqt)) {
+        stats_calc(cqt, 0, t);
+        return 1;
+    }
+    cqt->in[0] = cqt->input[0];
+    cqt->in[1] = cqt->input[1];
+    cqt->in_pos = cqt->input_pos;
+    cqt->in_mask = cqt->fft_size - 1;
+    calc_frame(cqt);
+    stats_calc(cqt, 1, t);
+    return 0;
+}
+
+/* Frame k of n reads the span src[k*hop .. k*hop + fft_size), its colors go to dst[k*width .. (k+1)*width)
+ * as get_color_array() would hold them after calc(). The span is read in place, without the input ring.
+ * The last frame stays in color_buf for rendering, see load_color(). If src1 is 0, src0 is used for both. */
+WASM_EXPORT WASM_SIMD_FUNCTION void calc_batch(ShowCQT *cqt, const float *src0, const float *src1, int n, int hop, ColorF *dst)
+{
+    double t = stats_clock();
+    cqt->in[0] = src0;
+    cqt->in[1] = src1 ? src1 : src0;
+    cqt->in_mask = -1;
+    cqt->last_valid = 0;
+    for (int k = 0; k < n; k++) {
+        cqt->in_pos = k * hop;
+        calc_frame(cqt);
+        for (int x = 0; x < cqt->width; x++)
+            dst[k * cqt->width + x] = cqt->color_buf[x];
+    }
+    stats_calc(cqt, n, t);
+}
+
+/* replace the colors of the current frame, e.g. with one frame of calc_batch() */
+WASM_EXPORT void load_color(ShowCQT *cqt, const ColorF *src)
+{
+    for (int x = 0; x < cqt->width; x++)
+        cqt->color_buf[x] = src[x];
+    cqt->prerender = PRERENDER_COLORS;
+    cqt->last_valid = 0;
+}
+
+static void prerender(ShowCQT *cqt)
+{
+    float max_h = 0.0f;
+    for (int x = 0; x < cqt->width; x++) {
+        ColorF *c = cqt->color_buf;
+        c[x].r = 255.5f * (c[x].r >= 0.0f ? (c[x].r <= 1.0f ? c[x].r : 1.0f) : 0.0f);
+        c[x].g = 255.5f * (c[x].g >= 0.0f ? (c[x].g <= 1.0f ? c[x].g : 1.0f) : 0.0f);
+        c[x].b = 255.5f * (c[x].b >= 0.0f ? (c[x].b <= 1.0f ? c[x].b : 1.0f) : 0.0f);
+        c[x].h = c[x].h >= 0.0f ? c[x].h : 0.0f;
+        max_h = c[x].h > max_h ? c[x].h : max_h;
+    }
+    for (int x = 0; cqt->peak && x < cqt->width; x++)
+        max_h = cqt->peak_buf[x] > max_h ? cqt->peak_buf[x] : max_h;
+    cqt->max_h = max_h;
+
+#if WASM_SIMD
+    for (int x = cqt->width; x < cqt->aligned_width; x++) {
+        cqt->color_buf[x] = (ColorF){ 0, 0, 0, 0 };
+    }
+#endif
+
+    for (int x = 0; x < cqt->aligned_width; x++)
+        cqt->rcp_h_buf[x] = 1.0f / (cqt->color_buf[x].h + 0.0001f);
+
+#if WASM_SIMD
+    for (int x = 0; x < cqt->aligned_width; x += SIMD_WIDTH) {
+        ColorFN color;
+        for (int k = 0; k < SIMD_WIDTH; k++) {
+            color.r[k] = cqt->color_buf[x+k].r;
+            color.g[k] = cqt->color_buf[x+k].g;
+            color.b[k] = cqt->color_buf[x+k].b;
+            color.h[k] = cqt->color_buf[x+k].h;
+        }
+        *(ColorFN *)(cqt->color_buf + x) = color;
+    }
+#endif
+
+}
+
+/* A row to render: the bars at height ht, the sonogram line of color_buf, or a line of sono_buf.
+ * With set_peak() bar is BAR_PEAK, markers in (ht, top] are drawn at the full color of their bin. */
+typedef struct RenderRow {
+    const unsigned *line;
+    float       ht;
+    int         bar;
+    float       top;
+} RenderRow;
+
+#define BAR_PEAK 2
+
+static ALWAYS_INLINE RenderRow render_row(const ShowCQT *cqt, int y)
+{
+    int bar = y >= 0 && y < cqt->height ? 1 + !!cqt->peak : 0;
+    /* markers clipped at the top stay on the first row */
+    float top = y > 0 ? (cqt->height - y + 1) / (float) cqt->height : 3.0e38f;
+    return (RenderRow){ 0, (cqt->height - y) / (float) cqt->height, bar, top };
+}
+
+static ALWAYS_INLINE RenderRow sono_row(const ShowCQT *cqt, int order, int k)
+{
+    int line = order ? cqt->sono_head + 1 + k : cqt->sono_head + cqt->sono_lines - k;
+    return (RenderRow){ cqt->sono_buf + (line % cqt->sono_lines) * cqt->width, 0, 0, 0 };
+}
+
+/* a bar row above every bar and marker, all of its pixels are transparent */
+static ALWAYS_INLINE int row_clear(const ShowCQT *cqt, RenderRow row)
+{
+    return row.bar && !(cqt->max_h > row.ht);
+}
+
+/* first bar row that may be lit by a bar or marker of height h, one row early for rounding */
+static ALWAYS_INLINE int row_top(const ShowCQT *cqt, float h)
+{
+    float y = cqt->height - h * cqt->height;
+    return y > 0.0f ? (y < cqt->height ? (int) y : cqt->height) : 0;
+}
+
+/* runs code with the kind of row known, so that each kind gets its own loop */
+#define RENDER_ROW_SWITCH(row, ...)                                             \
+    if (row.line) {                                                             \
+        row.bar = 0;                                                            \
+        __VA_ARGS__                                                             \
+    } else if (row.bar == BAR_PEAK) {                                           \
+        row.bar = BAR_PEAK;                                                     \
+        __VA_ARGS__                                                             \
+    } else if (row.bar) {                                                       \
+        row.bar = 1;                                                            \
+        __VA_ARGS__                                                             \
+    } else {                                                                    \
+        __VA_ARGS__                                                             \
+    }
+
+/* BT.601 limited range, rounded. Chroma takes the sums of the 2x2 pixels it covers. */
+#define YUV_Y(r, g, b) (16.5f + 0.256788f * (r) + 0.504129f * (g) + 0.097906f * (b))
+#define YUV_U(r, g, b) (128.5f + 0.25f * (-0.148223f * (r) - 0.290993f * (g) + 0.439216f * (b)))
+#define YUV_V(r, g, b) (128.5f + 0.25f * (0.439216f * (r) - 0.367788f * (g) - 0.071427f * (b)))
+
+#if !WASM_SIMD
+/* r, g, b of pixel x of row, returns 0 if it is transparent */
+static ALWAYS_INLINE int render_pixel(const ShowCQT *cqt, RenderRow row, int x, int *r, int *g, int *b)
+{
+    const ColorF *c = cqt->color_buf + x;
+
+    if (row.line) {
+        *r = row.line[x] & 0xFF;
+        *g = (row.line[x] >> 8) & 0xFF;
+        *b = (row.line[x] >> 16) & 0xFF;
+        return 1;
+    }
+
+    if (!row.bar || (row.bar == BAR_PEAK && cqt->peak_buf[x] > row.ht && cqt->peak_buf[x] <= row.top)) {
+        *r = c->r;
+        *g = c->g;
+        *b = c->b;
+        return 1;
+    }
+
+    if (c->h <= row.ht)
+        return 0;
+
+    float mul = (c->h - row.ht) * cqt->rcp_h_buf[x];
+    *r = mul * c->r;
+    *g = mul * c->g;
+    *b = mul * c->b;
+    return 1;
+}
+
+static ALWAYS_INLINE void store_pixel(uint8_t *out, int x, int format, int r, int g, int b, unsigned a)
+{
+    if (format == FORMAT_RGB565) {
+        ((uint16_t *) out)[x] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+    } else if (format == FORMAT_BGRA) {
+        r = r << 16;
+        g = g << 8;
+        ((unsigned *) out)[x] = (b | g) | (r | a);
+    } else {
+        g = g << 8;
+        b = b << 16;
+        ((unsigned *) out)[x] = (r | g) | (b | a);
+    }
+}
+
+static ALWAYS_INLINE void render_line(const ShowCQT *cqt, uint8_t *out, int width, RenderRow row, unsigned a, int format)
+{
+    if (row_clear(cqt, row)) {
+        for (int x = 0; x < width; x++)
+            store_pixel(out, x, format, 0, 0, 0, a);
+        return;
+    }
+
+    RENDER_ROW_SWITCH(row,
+        for (int x = 0; x < width; x++) {
+            int r = 0, g = 0, b = 0;
+            render_pixel(cqt, row, x, &r, &g, &b);
+            store_pixel(out, x, format, r, g, b, a);
+        }
+    )
+}
+
+/* rgba rows y0 .. y1-1 of the SIMD_WIDTH columns from x, see render_frame_delta() */
+static ALWAYS_INLINE void render_span(const ShowCQT *cqt, unsigned *dst, int stride, int x, int y0, int y1, unsigned a)
+{
+    int x1 = x + SIMD_WIDTH < cqt->width ? x + SIMD_WIDTH : cqt->width;
+    for (int y = y0; y < y1; y++) {
+        RenderRow row = render_row(cqt, y);
+        for (int k = x; k < x1; k++) {
+            int r = 0, g = 0, b = 0;
+            render_pixel(cqt, row, k, &r, &g, &b);
+            store_pixel((uint8_t *)(dst + y * stride), k, FORMAT_RGBA, r, g, b, a);
+        }
+    }
+}
+
+/* rows row0 and row1 as 4:2:0, y1 is 0 when row1 repeats row0 at an odd last row */
+static ALWAYS_INLINE void render_line_yuv(const ShowCQT *cqt, RenderRow row0, RenderRow row1, int width, int format,
+                                          uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v)
+{
+    for (int x = 0; x < width; x += 2) {
+        /* at an odd width, the last 2x2 block repeats its left column */
+        int xn = x + 1 < width ? x + 1 : x;
+        int r[4] = { 0 }, g[4] = { 0 }, b[4] = { 0 };
+        render_pixel(cqt, row0, x, &r[0], &g[0], &b[0]);
+        render_pixel(cqt, row0, xn, &r[1], &g[1], &b[1]);
+        render_pixel(cqt, row1, x, &r[2], &g[2], &b[2]);
+        render_pixel(cqt, row1, xn, &r[3], &g[3], &b[3]);
+
+        y0[x] = (int) YUV_Y(r[0], g[0], b[0]);
+        y0[xn] = (int) YUV_Y(r[1], g[1], b[1]);
+        if (y1) {
+            y1[x] = (int) YUV_Y(r[2], g[2], b[2]);
+            y1[xn] = (int) YUV_Y(r[3], g[3], b[3]);
+        }
+
+        float rs = (r[0] + r[1]) + (r[2] + r[3]);
+        float gs = (g[0] + g[1]) + (g[2] + g[3]);
+        float bs = (b[0] + b[1]) + (b[2] + b[3]);
+        if (format == FORMAT_NV12) {
+            u[x] = (int) YUV_U(rs, gs, bs);
+            u[x+1] = (int) YUV_V(rs, gs, bs);
+        } else {
+            u[x>>1] = (int) YUV_U(rs, gs, bs);
+            v[x>>1] = (int) YUV_V(rs, gs, bs);
+        }
+    }
+}
+#else
+/* The low byte of each int32 lane, of the even lanes, and of the even lanes of a and b interleaved.
+ * Byte shuffles, gcc would extract the lanes one by one for a __builtin_convertvector() to uint8. */
+#define AS_BYTES(v) ((uint8xNb)(v))
+#if SIMD_WIDTH >= 16
+#define PAIR_SWAP(v) __builtin_shufflevector(v, v, 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14)
+#define LANE_BYTES(v) __builtin_shufflevector(AS_BYTES(v), AS_BYTES(v), 0, 4, 8, 12, 16, 20, 24, 28, 32, 36, 40, 44, 48, 52, 56, 60)
+#define EVEN_BYTES(v) __builtin_shufflevector(AS_BYTES(v), AS_BYTES(v), 0, 8, 16, 24, 32, 40, 48, 56)
+#define EVEN_ZIP_BYTES(a, b) \
+    __builtin_shufflevector(AS_BYTES(a), AS_BYTES(b), 0, 64, 8, 72, 16, 80, 24, 88, 32, 96, 40, 104, 48, 112, 56, 120)
+#elif SIMD_WIDTH >= 8
+#define PAIR_SWAP(v) __builtin_shufflevector(v, v, 1, 0, 3, 2, 5, 4, 7, 6)
+#define LANE_BYTES(v) __builtin_shufflevector(AS_BYTES(v), AS_BYTES(v), 0, 4, 8, 12, 16, 20, 24, 28)
+#define EVEN_BYTES(v) __builtin_shufflevector(AS_BYTES(v), AS_BYTES(v), 0, 8, 16, 24)
+#define EVEN_ZIP_BYTES(a, b) __builtin_shufflevector(AS_BYTES(a), AS_BYTES(b), 0, 32, 8, 40, 16, 48, 24, 56)
+#else
+#define PAIR_SWAP(v) __builtin_shufflevector(v, v, 1, 0, 3, 2)
+#define LANE_BYTES(v) __builtin_shufflevector(AS_BYTES(v), AS_BYTES(v), 0, 4, 8, 12)
+#define EVEN_BYTES(v) __builtin_shufflevector(AS_BYTES(v), AS_BYTES(v), 0, 8)
+#define EVEN_ZIP_BYTES(a, b) __builtin_shufflevector(AS_BYTES(a), AS_BYTES(b), 0, 16, 8, 24)
+#endif
+
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void store_line(unsigned *out, int x, int width, uint32xN v)
+{
+    if (x + SIMD_WIDTH <= width) {
+        *(uint32xNu *)(out + x) = v;
+    } else {
+        for (int k = 0; k < width - x; k++)
+            out[x+k] = v[k];
+    }
+}
+
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void store_line16(uint16_t *out, int x, int width, uint16xNu v)
+{
+    if (x + SIMD_WIDTH <= width) {
+        *(uint16xNu *)(out + x) = v;
+    } else {
+        for (int k = 0; k < width - x; k++)
+            out[x+k] = v[k];
+    }
+}
+
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void store_line8(uint8_t *out, int x, int width, uint8xNu v)
+{
+    if (x + SIMD_WIDTH <= width) {
+        *(uint8xNu *)(out + x) = v;
+    } else {
+        for (int k = 0; k < width - x; k++)
+            out[x+k] = v[k];
+    }
+}
+
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void store_line8h(uint8_t *out, int x, int width, uint8xHu v)
+{
+    if (x + SIMD_WIDTH / 2 <= width) {
+        *(uint8xHu *)(out + x) = v;
+    } else {
+        for (int k = 0; k < width - x; k++)
+            out[x+k] = v[k];
+    }
+}
+
+/* r, g, b of pixels x .. x+SIMD_WIDTH-1 of row, returns 0 if they are all transparent */
+static ALWAYS_INLINE WASM_SIMD_FUNCTION int render_block(const ShowCQT *cqt, RenderRow row, int x,
+                                                         int32xN *r, int32xN *g, int32xN *b)
+{
+    if (row.line) {
+        uint32xN v = *(const uint32xNu *)(row.line + x);
+        *r = (int32xN)(v & 0xFF);
+        *g = (int32xN)((v >> 8) & 0xFF);
+        *b = (int32xN)((v >> 16) & 0xFF);
+        return 1;
+    }
+
+    ColorFN color = *(ColorFN *)(cqt->color_buf + x);
+    if (row.bar) {
+        float32xN ht = (float32xN){0} + row.ht;
+        int32xN mask = color.h > ht;
+        int32xN peak = {0};
+        if (row.bar == BAR_PEAK) {
+            float32xN p = *(float32xN *)(cqt->peak_buf + x);
+            peak = (p > ht) & (p <= (float32xN){0} + row.top);
+        }
+        if (!any_true(mask | peak))
+            return 0;
+        float32xN mul = (color.h - ht) * *(float32xN *)(cqt->rcp_h_buf + x);
+        mul = (float32xN)(((int32xN)mul & mask & ~peak) | ((int32xN)((float32xN){0} + 1.0f) & peak));
+        color.r = mul * color.r;
+        color.g = mul * color.g;
+        color.b = mul * color.b;
+    }
+
+    *r = __builtin_convertvector(color.r, int32xN);
+    *g = __builtin_convertvector(color.g, int32xN);
+    *b = __builtin_convertvector(color.b, int32xN);
+    return 1;
+}
+
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void store_pixels(uint8_t *out, int x, int width, int format,
+                                                          int32xN r, int32xN g, int32xN b, int32xN a)
+{
+    if (format == FORMAT_RGB565) {
+        int32xN v = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+        store_line16((uint16_t *) out, x, width, __builtin_convertvector(v, uint16xNu));
+    } else if (format == FORMAT_BGRA) {
+        r = r << 16;
+        g = g << 8;
+        store_line((unsigned *) out, x, width, (uint32xN)((b | g) | (r | a)));
+    } else {
+        g = g << 8;
+        b = b << 16;
+        store_line((unsigned *) out, x, width, (uint32xN)((r | g) | (b | a)));
+    }
+}
+
+/* width may be unaligned, the tail is stored without touching pixels past width */
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void render_line(const ShowCQT *cqt, uint8_t *out, int width, RenderRow row,
+                                                         unsigned alpha, int format)
+{
+    int32xN a = (int32xN){0} + (int) alpha;
+    int32xN zero = (int32xN){0};
+
+    if (row_clear(cqt, row)) {
+        for (int x = 0; x < width; x += SIMD_WIDTH)
+            store_pixels(out, x, width, format, zero, zero, zero, a);
+        return;
+    }
+
+    RENDER_ROW_SWITCH(row,
+        for (int x = 0; x < width; x += SIMD_WIDTH) {
+            int32xN r, g, b;
+            if (render_block(cqt, row, x, &r, &g, &b))
+                store_pixels(out, x, width, format, r, g, b, a);
+            else
+                store_pixels(out, x, width, format, zero, zero, zero, a);
+        }
+    )
+}
+
+/* rgba rows y0 .. y1-1 of the SIMD_WIDTH columns from x, see render_frame_delta() */
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void render_span(const ShowCQT *cqt, unsigned *dst, int stride, int x, int y0, int y1,
+                                                         unsigned alpha)
+{
+    int32xN a = (int32xN){0} + (int) alpha;
+    int32xN zero = (int32xN){0};
+
+    for (int y = y0; y < y1; y++) {
+        int32xN r, g, b;
+        if (render_block(cqt, render_row(cqt, y), x, &r, &g, &b))
+            store_pixels((uint8_t *)(dst + y * stride), x, cqt->width, FORMAT_RGBA, r, g, b, a);
+        else
+            store_pixels((uint8_t *)(dst + y * stride), x, cqt->width, FORMAT_RGBA, zero, zero, zero, a);
+    }
+}
+
+/* rows row0 and row1 as 4:2:0, y1 is 0 when row1 repeats row0 at an odd last row */
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void render_line_yuv(const ShowCQT *cqt, RenderRow row0, RenderRow row1, int width,
+                                                             int format, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v)
+{
+    int cw = (width + 1) >> 1;
+    for (int x = 0; x < width; x += SIMD_WIDTH) {
+        int32xN r0 = {0}, g0 = {0}, b0 = {0}, r1 = {0}, g1 = {0}, b1 = {0};
+        render_block(cqt, row0, x, &r0, &g0, &b0);
+        render_block(cqt, row1, x, &r1, &g1, &b1);
+
+        float32xN fr0 = __builtin_convertvector(r0, float32xN);
+        float32xN fg0 = __builtin_convertvector(g0, float32xN);
+        float32xN fb0 = __builtin_convertvector(b0, float32xN);
+        float32xN fr1 = __builtin_convertvector(r1, float32xN);
+        float32xN fg1 = __builtin_convertvector(g1, float32xN);
+        float32xN fb1 = __builtin_convertvector(b1, float32xN);
+        store_line8(y0, x, width, LANE_BYTES(__builtin_convertvector(YUV_Y(fr0, fg0, fb0), int32xN)));
+        if (y1)
+            store_line8(y1, x, width, LANE_BYTES(__builtin_convertvector(YUV_Y(fr1, fg1, fb1), int32xN)));
+
+        float32xN rs = fr0 + fr1, gs = fg0 + fg1, bs = fb0 + fb1;
+        /* at an odd width, the last 2x2 block repeats its left column */
+        if (x + SIMD_WIDTH > width && (width & 1)) {
+            int k = width - x;
+            rs[k] = rs[k-1];
+            gs[k] = gs[k-1];
+            bs[k] = bs[k-1];
+        }
+        rs += PAIR_SWAP(rs);
+        gs += PAIR_SWAP(gs);
+        bs += PAIR_SWAP(bs);
+        int32xN cu = __builtin_convertvector(YUV_U(rs, gs, bs), int32xN);
+        int32xN cv = __builtin_convertvector(YUV_V(rs, gs, bs), int32xN);
+
+        /* the even lanes hold the sums of the 2x2 blocks */
+        if (format == FORMAT_NV12) {
+            store_line8(u, x, cw << 1, EVEN_ZIP_BYTES(cu, cv));
+        } else {
+            store_line8h(u, x >> 1, cw, EVEN_BYTES(cu));
+            store_line8h(v, x >> 1, cw, EVEN_BYTES(cv));
+        }
+    }
+}
+#endif
+
+#if SHOWCQT_STATS
+/* bar rows y0 .. y1-1 were rendered */
+static void stats_render(ShowCQT *cqt, int y0, int y1, double t)
+{
+    stats_call(cqt->stats, STAT_RENDER_CALLS, t);
+    for (int y = y0; y < y1; y++) {
+        RenderRow row = render_row(cqt, y);
+        cqt->stats[STAT_TRANSPARENT_ROWS] += row_clear(cqt, row);
+    }
+}
+#else
+static ALWAYS_INLINE void stats_render(ShowCQT *cqt, int y0, int y1, double t) { (void) cqt; (void) y0; (void) y1; (void) t; }
+#endif
+
+static WASM_SIMD_FUNCTION void prerender_frame(ShowCQT *cqt)
+{
+    double t = stage_begin(cqt);
+    if (cqt->prerender == PRERENDER_COLORS) {
+        stats_prerender(cqt);
+        prerender(cqt);
+    }
+    cqt->prerender = 0;
+    if (cqt->sono_lines) {
+        cqt->sono_head = (cqt->sono_head + 1) % cqt->sono_lines;
+        render_line(cqt, (uint8_t *)(cqt->sono_buf + cqt->sono_head * cqt->width), cqt->width,
+                    render_row(cqt, -1), 0xFF000000, FORMAT_RGBA);
+    }
+    stage_end(cqt, STAGE_PRERENDER, t);
+}
+
+WASM_EXPORT WASM_SIMD_FUNCTION void render_line_alpha(ShowCQT *cqt, int y, uint8_t alpha)
+{
+    double t = stats_clock();
+    if (cqt->prerender)
+        prerender_frame(cqt);
+
+    render_line(cqt, (uint8_t *) cqt->output, cqt->aligned_width, render_row(cqt, y), (unsigned) alpha << 24, FORMAT_RGBA);
+    stats_render(cqt, y, y + 1, t);
+}
+
+WASM_EXPORT WASM_SIMD_FUNCTION void render_frame(ShowCQT *cqt, int y0, int y1, uint8_t alpha, unsigned *dst, int stride)
+{
+    double t = stats_clock();
+    if (cqt->prerender)
+        prerender_frame(cqt);
+
+    if (dst == cqt->delta_dst)
+        cqt->delta_valid = 0;
+    for (int y = y0; y < y1; y++, dst += stride)
+        render_line(cqt, (uint8_t *) dst, cqt->width, render_row(cqt, y), (unsigned) alpha << 24, FORMAT_RGBA);
+    stats_render(cqt, y0, y1, t);
+}
+
+/* bar height of column x + k of a prerendered color buffer, x is a multiple of SIMD_WIDTH */
+static ALWAYS_INLINE float prerendered_h(const ColorF *buf, int x, int k)
+{
+#if WASM_SIMD
+    return ((const ColorFN *)(buf + x))->h[k];
+#else
+    return buf[x+k].h;
+#endif
+}
+
+/* appends the area of columns x0 .. x1-1 from row y to y1, past max_rects it grows the last one */
+static int add_rect(int *rects, int count, int max_rects, int x0, int x1, int y, int y1)
+{
+    if (count < max_rects) {
+        int *r = rects + 4 * count;
+        r[0] = x0;
+        r[1] = y;
+        r[2] = x1 - x0;
+        r[3] = y1 - y;
+        return count + 1;
+    }
+    if (max_rects) {
+        int *r = rects + 4 * (count - 1);
+        r[1] = y < r[1] ? y : r[1];
+        r[2] = x1 - r[0];
+        r[3] = y1 - r[1];
+    }
+    return count;
+}
+
+/* render_frame() of rows 0 .. y1-1 into a persistent dst, which holds what the previous call with the
+ * same dst, stride, y1 and alpha rendered. Only blocks of SIMD_WIDTH columns whose colors, bars or
+ * markers changed are redrawn, from the top of the higher of their old and new bars down. The redrawn
+ * areas go to rects as x, y, w, h, merged into the last one past max_rects. Returns their count, 0 if
+ * nothing changed. A render_frame*() into dst, init(), set_height() or delta_invalidate() make the next
+ * call redraw all. */
+WASM_EXPORT WASM_SIMD_FUNCTION int render_frame_delta(ShowCQT *cqt, int y1, uint8_t alpha, unsigned *dst, int stride,
+                                                     int *rects, int max_rects)
+{
+    double t = stats_clock();
+    if (cqt->prerender)
+        prerender_frame(cqt);
+
+    int full = !cqt->delta_valid || cqt->delta_dst != dst || cqt->delta_stride != stride ||
+               cqt->delta_rows != y1 || cqt->delta_alpha != alpha || cqt->delta_mode != cqt->peak;
+    cqt->delta_valid = 1;
+    cqt->delta_dst = dst;
+    cqt->delta_stride = stride;
+    cqt->delta_rows = y1;
+    cqt->delta_alpha = alpha;
+    cqt->delta_mode = cqt->peak;
+
+    int count = 0, run_x = -1, run_y = 0;
+    for (int x = 0; x < cqt->width; x += SIMD_WIDTH) {
+        uint32_t *cur = (uint32_t *)(cqt->color_buf + x), *old = (uint32_t *)(cqt->delta_buf + x);
+        uint32_t *peak = (uint32_t *)(cqt->peak_buf + x), *old_peak = (uint32_t *)(cqt->delta_peak + x);
+        /* without simd, color_buf is not padded past width */
+        int n = cqt->aligned_width - x < SIMD_WIDTH ? cqt->aligned_width - x : SIMD_WIDTH;
+        int changed = full;
+        float h = 0.0f;
+        for (int k = 0; k < n; k++) {
+            float hk = prerendered_h(cqt->color_buf, x, k), ho = prerendered_h(cqt->delta_buf, x, k);
+            h = hk > h ? hk : h;
+            h = ho > h ? ho : h;
+            if (cqt->peak) {
+                h = cqt->peak_buf[x+k] > h ? cqt->peak_buf[x+k] : h;
+                h = cqt->delta_peak[x+k] > h ? cqt->delta_peak[x+k] : h;
+                changed |= peak[k] != old_peak[k];
+                old_peak[k] = peak[k];
+            }
+        }
+        for (int k = 0; k < 4 * n; k++) {
+            changed |= cur[k] != old[k];
+            old[k] = cur[k];
+        }
+
+        int y0 = full ? 0 : row_top(cqt, h);
+        y0 = y0 < y1 ? y0 : y1;
+        if (!changed || y0 == y1) {
+            if (run_x >= 0)
+                count = add_rect(rects, count, max_rects, run_x, x, run_y, y1);
+            run_x = -1;
+            continue;
+        }
+
+        render_span(cqt, dst, stride, x, y0, y1, (unsigned) alpha << 24);
+        run_y = run_x >= 0 && run_y < y0 ? run_y : y0;
+        run_x = run_x >= 0 ? run_x : x;
+    }
+    if (run_x >= 0)
+        count = add_rect(rects, count, max_rects, run_x, cqt->width, run_y, y1);
+
+    /* counted as render_frame() of rows 0 .. y1-1, the transparent rows above every bar are never redrawn here */
+    stats_render(cqt, 0, y1, t);
+    return count;
+}
+
+/* the next render_frame_delta() redraws all, for callers that wrote into its dst themselves */
+WASM_EXPORT void delta_invalidate(ShowCQT *cqt)
+{
+    cqt->delta_valid = 0;
+}
+
+#if !WASM_SIMD
+WASM_EXPORT void render_sono(ShowCQT *cqt, int order, uint8_t alpha, unsigned *dst, int stride)
+{
+    double t = stats_clock();
+    if (cqt->prerender)
+        prerender_frame(cqt);
+
+    unsigned a = ((unsigned) alpha) << 24;
+
+    for (int k = 0; k < cqt->sono_lines; k++, dst += stride) {
+        const unsigned *src = sono_row(cqt, order, k).line;
+        for (int x = 0; x < cqt->width; x++)
+            dst[x] = (src[x] & 0x00FFFFFF) | a;
+    }
+    stats_render(cqt, 0, 0, t);
+}
+#else
+WASM_EXPORT WASM_SIMD_FUNCTION void render_sono(ShowCQT *cqt, int order, uint8_t alpha, unsigned *dst, int stride)
+{
+    double t = stats_clock();
+    if (cqt->prerender)
+        prerender_frame(cqt);
+
+    uint32xN a = (uint32xN){0} + ((unsigned) alpha << 24);
+    uint32xN m = (uint32xN){0} + 0x00FFFFFF;
+
+    for (int k = 0; k < cqt->sono_lines; k++, dst += stride) {
+        const unsigned *src = sono_row(cqt, order, k).line;
+        for (int x = 0; x < cqt->width; x += SIMD_WIDTH)
+            store_line(dst, x, cqt->width, (*(const uint32xNu *)(src + x) & m) | a);
+    }
+    stats_render(cqt, 0, 0, t);
+}
+#endif
+
+/* row k of render_frame_format(), or of render_sono_format() if order >= 0 */
+static ALWAYS_INLINE RenderRow format_row(const ShowCQT *cqt, int order, int k)
+{
+    return order < 0 ? render_row(cqt, k) : sono_row(cqt, order, k);
+}
+
+/* a pair of transparent rows in 4:2:0, black */
+static ALWAYS_INLINE void fill_line_yuv(int width, int format, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v)
+{
+    for (int x = 0; x < width; x++)
+        y0[x] = 16;
+    for (int x = 0; y1 && x < width; x++)
+        y1[x] = 16;
+    for (int x = 0; x < width; x += 2) {
+        if (format == FORMAT_NV12) {
+            u[x] = 128;
+            u[x+1] = 128;
+        } else {
+            u[x>>1] = 128;
+            v[x>>1] = 128;
+        }
+    }
+}
+
+static ALWAYS_INLINE WASM_SIMD_FUNCTION void render_rows(const ShowCQT *cqt, int order, int k0, int k1, unsigned a, int format,
+                                                         uint8_t *dst, int stride, uint8_t *dst_u, uint8_t *dst_v, int stride_c)
+{
+    if (format == FORMAT_I420 || format == FORMAT_NV12) {
+        for (int k = k0; k < k1; k += 2, dst += 2 * stride, dst_u += stride_c, dst_v += stride_c) {
+            int kn = k + 1 < k1 ? k + 1 : k;
+            RenderRow row0 = format_row(cqt, order, k), row1 = format_row(cqt, order, kn);
+            if (row_clear(cqt, row0) && row_clear(cqt, row1))
+                fill_line_yuv(cqt->width, format, dst, kn > k ? dst + stride : 0, dst_u, dst_v);
+            else
+                render_line_yuv(cqt, row0, row1, cqt->width, format, dst, kn > k ? dst + stride : 0, dst_u, dst_v);
+        }
+    } else {
+        for (int k = k0; k < k1; k++, dst += stride)
+            render_line(cqt, dst, cqt->width, format_row(cqt, order, k), a, format);
+    }
+}
+
+/* the format is a constant in each case, so each one gets its own loop */
+static WASM_SIMD_FUNCTION void render_rows_format(const ShowCQT *cqt, int order, int k0, int k1, uint8_t alpha, int format,
+                                                  uint8_t *dst, int stride, uint8_t *dst_u, uint8_t *dst_v, int stride_c)
+{
+    unsigned a = (unsigned) alpha << 24;
+    switch (format) {
+        case FORMAT_RGBA: render_rows(cqt, order, k0, k1, a, FORMAT_RGBA, dst, stride, dst_u, dst_v, stride_c); break;
+        case FORMAT_BGRA: render_rows(cqt, order, k0, k1, a, FORMAT_BGRA, dst, stride, dst_u, dst_v, stride_c); break;
+        case FORMAT_RGB565: render_rows(cqt, order, k0, k1, a, FORMAT_RGB565, dst, stride, dst_u, dst_v, stride_c); break;
+        case FORMAT_I420: render_rows(cqt, order, k0, k1, a, FORMAT_I420, dst, stride, dst_u, dst_v, stride_c); break;
+        case FORMAT_NV12: render_rows(cqt, order, k0, k1, a, FORMAT_NV12, dst, stride, dst_u, dst_v, stride_c); break;
+    }
+}
+
+/* render_frame() in another pixel format, stride is in bytes. Packed formats only use dst.
+ * 4:2:0 formats render rows in pairs from y0, which should be even: luma to dst, chroma row (y - y0) / 2
+ * to dst_u and dst_v (nv12 only uses dst_u) with stride_c. An odd last row is paired with itself.
+ * Alpha is dropped by rgb565 and 4:2:0, transparent pixels are black. */
+WASM_EXPORT WASM_SIMD_FUNCTION void render_frame_format(ShowCQT *cqt, int y0, int y1, uint8_t alpha, int format,
+                                                        uint8_t *dst, int stride, uint8_t *dst_u, uint8_t *dst_v, int stride_c)
+{
+    double t = stats_clock();
+    if (cqt->prerender)
+        prerender_frame(cqt);
+
+    if ((void *) dst == cqt->delta_dst)
+        cqt->delta_valid = 0;
+    render_rows_format(cqt, -1, y0, y1, alpha, format, dst, stride, dst_u, dst_v, stride_c);
+    stats_render(cqt, y0, y1, t);
+}
+
+/* render_sono() in another pixel format, the arguments are those of render_frame_format() */
+WASM_EXPORT WASM_SIMD_FUNCTION void render_sono_format(ShowCQT *cqt, int order, uint8_t alpha, int format,
+                                                       uint8_t *dst, int stride, uint8_t *dst_u, uint8_t *dst_v, int stride_c)
+{
+    double t = stats_clock();
+    if (cqt->prerender)
+        prerender_frame(cqt);
+
+    render_rows_format(cqt, !!order, 0, cqt->sono_lines, alpha, format, dst, stride, dst_u, dst_v, stride_c);
+    stats_render(cqt, 0, 0, t);
+}
+
+WASM_EXPORT void render_line_opaque(ShowCQT *cqt, int y)
+{
+    render_line_alpha(cqt, y, 255);
+}
+
+WASM_EXPORT void set_volume(ShowCQT *cqt, float bar_v, float sono_v)
+{
+    cqt->bar_v = (bar_v > MAX_VOL) ? MAX_VOL : (bar_v > MIN_VOL) ? bar_v : MIN_VOL;
+    cqt->sono_v = (sono_v > MAX_VOL) ? MAX_VOL : (sono_v > MIN_VOL) ? sono_v : MIN_VOL;
+    cqt->last_valid = 0;
+}
+
+static void ring_write(ShowCQT *cqt, const float *src0, const float *src1, int n, int stride)
+{
+    int pos = cqt->input_pos;
+    if (n > cqt->fft_size) {
+        src0 += (n - cqt->fft_size) * stride;
+        src1 += (n - cqt->fft_size) * stride;
+        n = cqt->fft_size;
+    }
+
+    cqt->input_pos = (pos + n) & (cqt->fft_size - 1);
+    while (n > 0) {
+        int len = cqt->fft_size - pos < n ? cqt->fft_size - pos : n;
+        float *dst0 = cqt->input[0] + pos, *dst1 = cqt->input[1] + pos;
+        for (int x = 0; x < len; x++) {
+            dst0[x] = src0[x*stride];
+            dst1[x] = src1[x*stride];
+        }
+        src0 += len * stride;
+        src1 += len * stride;
+        n -= len;
+        pos = 0;
+    }
+}
+
+/* sample m of both channels of the INIT_DECIMATE lowpass from dec_hist[c] + m * input_dec */
+#if WASM_SIMD
+static WASM_SIMD_FUNCTION void dec_calc(const ShowCQT *cqt, int m, float *y0, float *y1)
+{
+    const float *coef = cqt->dec_coef, *h0 = cqt->dec_hist[0] + m, *h1 = cqt->dec_hist[1] + m;
+    float32x4 a0 = {0}, b0 = {0}, a1 = {0}, b1 = {0};
+    for (int k = 0; k < cqt->dec_taps; k += DEC_STEP) {
+        float32x4 c0 = *(const float32x4 *)(coef + k), c1 = *(const float32x4 *)(coef + k + 4);
+        a0 += c0 * *(const float32x4u *)(h0 + k);
+        b0 += c1 * *(const float32x4u *)(h0 + k + 4);
+        a1 += c0 * *(const float32x4u *)(h1 + k);
+        b1 += c1 * *(const float32x4u *)(h1 + k + 4);
+    }
+    a0 += b0;
+    a1 += b1;
+    *y0 = (a0[0] + a0[1]) + (a0[2] + a0[3]);
+    *y1 = (a1[0] + a1[1]) + (a1[2] + a1[3]);
+}
+#else
+static void dec_calc(const ShowCQT *cqt, int m, float *y0, float *y1)
+{
+    const float *coef = cqt->dec_coef, *h0 = cqt->dec_hist[0] + m, *h1 = cqt->dec_hist[1] + m;
+    float a0 = 0, a1 = 0;
+    for (int k = 0; k < cqt->dec_taps; k++) {
+        a0 += coef[k] * h0[k];
+        a1 += coef[k] * h1[k];
+    }
+    *y0 = a0;
+    *y1 = a1;
+}
+#endif
+
+/* Polyphase decimation of INIT_DECIMATE, the lowpass runs only at the samples that are kept. Input goes
+ * through dec_hist in blocks of DEC_BLOCK, the last dec_taps - input_dec samples or less stay for the next
+ * call. Output sample m of a block ends at input sample m * input_dec + dec_taps - 1. */
+static WASM_SIMD_FUNCTION void dec_write(ShowCQT *cqt, const float *src0, const float *src1, int n, int stride)
+{
+    float y[2][DEC_BLOCK / 2 + 1];
+    int dec = cqt->input_dec, taps = cqt->dec_taps;
+    float *h0 = cqt->dec_hist[0], *h1 = cqt->dec_hist[1];
+
+    /* the ring keeps fft_size samples, their lowpass needs dec_taps more */
+    int keep = (cqt->fft_size + 1) * dec + taps;
+    if (n > keep) {
+        int skip = (n - keep) / dec * dec;
+        src0 += skip * stride;
+        src1 += skip * stride;
+        n -= skip;
+    }
+
+    while (n > 0) {
+        int fill = cqt->dec_fill, len = taps + DEC_BLOCK - fill < n ? taps + DEC_BLOCK - fill : n;
+        for (int x = 0; x < len; x++) {
+            h0[fill + x] = src0[x * stride];
+            h1[fill + x] = src1[x * stride];
+        }
+        src0 += len * stride;
+        src1 += len * stride;
+        n -= len;
+        fill += len;
+
+        int m = fill < taps ? 0 : (fill - taps) / dec + 1;
+        for (int k = 0; k < m; k++)
+            dec_calc(cqt, k * dec, &y[0][k], &y[1][k]);
+        ring_write(cqt, y[0], y[1], m, 1);
+
+        for (int x = m * dec; x < fill; x++) {
+            h0[x - m * dec] = h0[x];
+            h1[x - m * dec] = h1[x];
+        }
+        cqt->dec_fill = fill - m * dec;
+    }
+}
+
+/* Append n samples to the input ring, only the last fft_size samples are kept. With INIT_DECIMATE
+ * they are decimated by input_dec first, see get_input_dec().
+ * Planar input uses stride 1, interleaved stereo uses stride 2 with src1 = src0 + 1.
+ * If src1 is 0, src0 is copied to both channels. */
+WASM_EXPORT int push_samples(ShowCQT *cqt, const float *src0, const float *src1, int n, int stride)
+{
+    if (!cqt->fft_size || n < 0 || stride < 1)
+        return 0;
+
+    src1 = src1 ? src1 : src0;
+    if (cqt->dec_taps)
+        dec_write(cqt, src0, src1, n, stride);
+    else
+        ring_write(cqt, src0, src1, n, stride);
+    return cqt->input_pos;
+}
+
+/* INIT_DECIMATE: input samples of push_samples() per ring sample, 1 without decimation.
+ * The ring, calc_batch() spans and the bins are at rate / get_input_dec(). */
+WASM_EXPORT int get_input_dec(ShowCQT *cqt)
+{
+    return cqt->input_dec;
+}
+
+/* position of the oldest sample in the input ring */
+WASM_EXPORT int get_input_pos(ShowCQT *cqt)
+{
+    return cqt->input_pos;
+}
+
+/* colors of mono mode, the sonogram is c * (r, g, b) of the grayscale intensity c */
+WASM_EXPORT void set_palette(ShowCQT *cqt, float r, float g, float b)
+{
+    cqt->palette = (ColorF){ r, g, b, 1 };
+    cqt->last_valid = 0;
+}
+
+/* Exponential smoothing of the colors and bar heights of each bin: every calc() moves them from
+ * the previous frame by attack of the change when they rise, by decay when they fall, 1 is off. */
+WASM_EXPORT void set_smoothing(ShowCQT *cqt, float attack, float decay)
+{
+    cqt->attack = attack > 0.0f && attack < 1.0f ? attack : 1.0f;
+    cqt->decay = decay > 0.0f && decay < 1.0f ? decay : 1.0f;
+    cqt->smooth = cqt->attack < 1.0f || cqt->decay < 1.0f;
+}
+
+/* Peak markers above the bars (fall < 0 is off): a marker rises with its bar, stays hold frames
+ * of calc(), then falls by fall bar heights per frame. The render draws it one row high. */
+WASM_EXPORT void set_peak(ShowCQT *cqt, int hold, float fall)
+{
+    cqt->peak = fall >= 0.0f;
+    cqt->peak_hold = hold > 0 ? hold : 0;
+    cqt->peak_fall = fall >= 0.0f ? fall : 0.0f;
+}
+
+/* Off (silence < 0) by default. When on, calc() first checks the input ring and returns 1 without
+ * computing if the frame would be the previous one: the ring and input_pos did not change, or every
+ * sample pair is silent (x0*x0 + x1*x1 <= silence) as it was at the previous calc(). The renders
+ * then skip prerender() and only add the sonogram line again, and a caller may keep the rows it
+ * rendered last. get_color_array() keeps the previous frame, prerendered if it was rendered.
+ * Frames are never reused while set_smoothing() or set_peak() is on. */
+WASM_EXPORT void set_skip_static(ShowCQT *cqt, float silence)
+{
+    cqt->skip_silence = silence >= 0 ? silence : -1;
+    last_input_alloc(cqt);
+}
+
+/* per stage timing of calc() and prerender, for benchmarks. Clears the times. */
+WASM_EXPORT void set_timing(ShowCQT *cqt, int on)
+{
+    cqt->timing = !!on;
+    for (int k = 0; k < STAGE_COUNT; k++)
+        cqt->stage_time[k] = 0;
+}
+
+/* ms spent in each STAGE_* since set_timing() */
+WASM_EXPORT double *get_stage_times(ShowCQT *cqt)
+{
+    return cqt->stage_time;
+}
+
+/* STAT_* counters since create() or reset_stats(), 0 if the build has no SHOWCQT_STATS */
+WASM_EXPORT double *get_stats(ShowCQT *cqt)
+{
+#if SHOWCQT_STATS
+    return cqt->stats;
+#else
+    (void) cqt;
+    return 0;
+#endif
+}
+
+WASM_EXPORT void reset_stats(ShowCQT *cqt)
+{
+#if SHOWCQT_STATS
+    for (int k = 0; k < STAT_COUNT; k++)
+        cqt->stats[k] = 0;
+#else
+    (void) cqt;
+#endif
+}
+
+WASM_EXPORT void set_height(ShowCQT *cqt, int height)
+{
+    cqt->height = (height > MAX_HEIGHT) ? MAX_HEIGHT : (height > 1) ? height : 1;
+    cqt->delta_valid = 0;
+}
+
+#if SHOWCQT_NATIVE
+const ShowCQTApi NATIVE_API = {
+    memory_alloc, memory_free, create, destroy,
+    get_input_array, get_output_array, get_color_array, get_sono_array, get_sono_head,
+    init, kernel_export_size, kernel_export, init_import, init_sono,
+    calc, render_line_alpha, render_line_opaque, render_frame, render_sono,
+    set_volume, push_samples, get_input_pos, set_palette, set_height, detect_silence,
+    calc_batch, load_color, render_frame_format, render_sono_format, set_range,
+    set_timing, get_stage_times, get_stats, reset_stats, set_skip_static,
+    set_smoothing, set_peak, render_frame_delta, get_input_dec, delta_invalidate
+};
+#endif
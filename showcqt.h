@@ -24,10 +24,38 @@
 
 #include <stdint.h>
 
+#ifndef SHOWCQT_NATIVE
+#define SHOWCQT_NATIVE 0
+#endif
+
+/* a native build links several variants of this file together, each one exported
+ * only through its NATIVE_API table, see showcqt-native.c */
+#if SHOWCQT_NATIVE
+#define WASM_EXPORT static
+#else
 #define WASM_EXPORT extern __attribute__((__visibility__("default")))
+#endif
 #define WASM_IMPORT extern __attribute__((__nothrow__))
 #define DECLARE_ALIGNED(n) __attribute__((__aligned__(n)))
-#define ALWAYS_INLINE __inline__ __attribute__((__always_inline__, __nodebug__))
+/* nodebug is clang only, gcc warns about it */
+#ifdef __has_attribute
+#if __has_attribute(__nodebug__)
+#define NODEBUG __attribute__((__nodebug__))
+#endif
+#endif
+#ifndef NODEBUG
+#define NODEBUG
+#endif
+#define ALWAYS_INLINE __inline__ __attribute__((__always_inline__)) NODEBUG
+/* gcc -O2 leaves the small arrays of the fft passes on the stack, clang -O2 unrolls their loops already */
+#ifdef __has_attribute
+#if __has_attribute(__optimize__)
+#define OPTIMIZE_LOOPS __attribute__((__optimize__("O3")))
+#endif
+#endif
+#ifndef OPTIMIZE_LOOPS
+#define OPTIMIZE_LOOPS
+#endif
 
 /* minimalist math.h definition */
 #define M_PI 3.14159265358979323846
@@ -39,25 +67,92 @@ WASM_IMPORT double log(double);
 WASM_IMPORT double exp(double);
 WASM_IMPORT double ceil(double);
 WASM_IMPORT double floor(double);
+WASM_IMPORT double sqrt(double);
 WASM_IMPORT float sqrtf(float);
 WASM_IMPORT void *memory_expand(int);
+WASM_IMPORT double clock_ms(void);
 
 #ifndef WASM_SIMD
 #define WASM_SIMD 0
 #endif
 
-#if WASM_SIMD
+/* instrumented build, see get_stats() */
+#ifndef SHOWCQT_STATS
+#define SHOWCQT_STATS 0
+#endif
+
+#if WASM_SIMD && !SHOWCQT_NATIVE
 #define WASM_SIMD_FUNCTION __attribute__((__target__("simd128")))
 #else
 #define WASM_SIMD_FUNCTION
 #endif
 
+/* widest float vector, native x86 variants go past the 128 bit of wasm simd */
+#if WASM_SIMD && defined(__AVX512F__)
+#define SIMD_WIDTH 16
+#elif WASM_SIMD && defined(__AVX2__)
+#define SIMD_WIDTH 8
+#else
+#define SIMD_WIDTH 4
+#endif
+
 #define MAX_FFT_SIZE 32768
 #define MAX_WIDTH 7680
 #define MAX_HEIGHT 4320
 #define MIN_VOL 1.0f
 #define MAX_VOL 100.0f
 
+/* tables no context uses are kept for a later init() of their configuration, least recently used freed first */
+#define TABLES_CACHE_SIZE 4
+
+/* frequency range of the bins, set_range() defaults to E0 to E10 */
+#define DEFAULT_FMIN 20.01523126408007475
+#define DEFAULT_FMAX 20495.59681441799654
+#define MIN_FREQ 1.0
+#define MAX_FREQ 100000.0
+
+/* init() flags */
+#define INIT_MONO 1
+#define INIT_MULTIRES 2 /* ignored in mono mode */
+#define INIT_COMPACT 4  /* 16 bit fixed point kernel with a per bin scale */
+#define INIT_DECIMATE 8 /* push_samples() decimates rates from 2 * DEC_RATE, see input_dec() */
+
+/* INIT_DECIMATE: the internal rate is rate / input_dec, at least DEC_RATE */
+#define DEC_RATE 44100
+#define MAX_INPUT_DEC 8
+
+/* calc() stages timed by set_timing(), get_stage_times() holds the ms spent in each */
+#define STAGE_INPUT 0       /* windowed column ffts of the four-step fft, multires decimation */
+#define STAGE_FFT 1         /* with the real fft split of mono */
+#define STAGE_KERNEL 2      /* kernel and color math */
+#define STAGE_FINISH 3      /* supersample averaging */
+#define STAGE_PRERENDER 4   /* done by the first render after calc() */
+#define STAGE_COUNT 5
+
+/* counters of get_stats(), kept by builds with SHOWCQT_STATS=1 only. Counts are exact up to 2^53. */
+#define STAT_CALC_CALLS 0       /* calc() and calc_batch() */
+#define STAT_CALC_TIME 1        /* ms spent in them */
+#define STAT_CALC_MAX 2         /* ms of the longest one */
+#define STAT_RENDER_CALLS 3     /* render_*() */
+#define STAT_RENDER_TIME 4
+#define STAT_RENDER_MAX 5
+#define STAT_KERNEL_TAPS 6      /* kernel multiply-adds, per frame each tile costs len * bins */
+#define STAT_BINS_SKIPPED 7     /* bins of tiles with len == 0 */
+#define STAT_TRANSPARENT_ROWS 8 /* bar rows above every bar */
+#define STAT_PRERENDERS 9
+#define STAT_COUNT 10
+
+/* ShowCQT.prerender, the work left for the first render after calc() */
+#define PRERENDER_COLORS 1  /* prerender() of new colors, then their sonogram line */
+#define PRERENDER_SONO 2    /* the frame was reused by calc(), its sonogram line again */
+
+/* pixel formats of render_frame_format() and render_sono_format() */
+#define FORMAT_RGBA 0   /* 0xAABBGGRR, as render_frame() */
+#define FORMAT_BGRA 1   /* 0xAARRGGBB */
+#define FORMAT_RGB565 2 /* 16 bit, red in the high bits, alpha is ignored */
+#define FORMAT_I420 3   /* 4:2:0, y plane, u plane and v plane */
+#define FORMAT_NV12 4   /* 4:2:0, y plane and interleaved uv plane */
+
 typedef struct Complex {
     float re, im;
 } Complex;
@@ -71,41 +166,160 @@ typedef float   float32x4   __attribute__((__vector_size__(16), __aligned__(16))
 typedef float   float32x4u  __attribute__((__vector_size__(16), __aligned__(4)));
 typedef int32_t int32x4     __attribute__((__vector_size__(16), __aligned__(16)));
 typedef uint32_t uint32x4   __attribute__((__vector_size__(16), __aligned__(16)));
+typedef uint32_t uint32x4u  __attribute__((__vector_size__(16), __aligned__(4)));
 typedef uint8_t uint8x16    __attribute__((__vector_size__(16), __aligned__(16)));
+typedef int16_t int16x4u    __attribute__((__vector_size__(8), __aligned__(2)));
 
 typedef struct Complex4 {
     float32x4 re, im;
 } Complex4;
 
-typedef struct ColorF4 {
-    float32x4 r, g, b, h;
-} ColorF4;
+#if SIMD_WIDTH >= 8
+typedef float   float32x8   __attribute__((__vector_size__(32), __aligned__(32)));
+typedef float   float32x8u  __attribute__((__vector_size__(32), __aligned__(4)));
+typedef int16_t int16x8u    __attribute__((__vector_size__(16), __aligned__(2)));
+
+typedef struct Complex8 {
+    float32x8 re, im;
+} Complex8;
 #endif
 
-typedef struct KernelIndex {
-    int len;
+#if SIMD_WIDTH >= 16
+typedef float   float32x16  __attribute__((__vector_size__(64), __aligned__(64)));
+typedef float   float32x16u __attribute__((__vector_size__(64), __aligned__(4)));
+typedef int16_t int16x16u   __attribute__((__vector_size__(32), __aligned__(2)));
+
+typedef struct Complex16 {
+    float32x16 re, im;
+} Complex16;
+#endif
+
+/* render_line() works on SIMD_WIDTH pixels, prerender() lays color_buf out in blocks of them.
+ * Buffers are only 16 byte aligned. */
+typedef float   float32xN   __attribute__((__vector_size__(4 * SIMD_WIDTH), __aligned__(16)));
+typedef int32_t int32xN     __attribute__((__vector_size__(4 * SIMD_WIDTH), __aligned__(16)));
+typedef uint32_t uint32xN   __attribute__((__vector_size__(4 * SIMD_WIDTH), __aligned__(16)));
+typedef uint32_t uint32xNu  __attribute__((__vector_size__(4 * SIMD_WIDTH), __aligned__(4)));
+typedef uint16_t uint16xNu  __attribute__((__vector_size__(2 * SIMD_WIDTH), __aligned__(2)));
+typedef uint8_t uint8xNu    __attribute__((__vector_size__(SIMD_WIDTH), __aligned__(1)));
+typedef uint8_t uint8xHu    __attribute__((__vector_size__(SIMD_WIDTH / 2), __aligned__(1)));
+typedef uint8_t uint8xNb    __attribute__((__vector_size__(4 * SIMD_WIDTH), __aligned__(16))); /* bytes of an int32xN */
+
+typedef struct ColorFN {
+    float32xN r, g, b, h;
+} ColorFN;
+
+#if SHOWCQT_NATIVE
+#define any_true(m) ({ __typeof__(m) m_ = (m); int r_ = 0;                 \
+    for (int k_ = 0; k_ < (int)(sizeof(m_) / sizeof(m_[0])); k_++)         \
+        r_ |= m_[k_];                                                       \
+    r_ != 0; })
+#else
+#define any_true(m) __builtin_wasm_any_true_v128(m)
+#endif
+#endif
+
+/* Adjacent bins x .. x+bins-1 sharing the fft span [start, start+len), len is a multiple of
+ * TILE_STEP. Their coefficients are stored per TILE_STEP positions of the span, bin by bin:
+ * kernel[(m / TILE_STEP * bins + b) * TILE_STEP + m % TILE_STEP], zero outside the bin's own window. */
+typedef struct KernelTile {
     int start;
-} KernelIndex;
+    int len;
+    int x;
+    int bins;
+} KernelTile;
 
-typedef struct ShowCQT {
-    /* args */
-    float       input[2][MAX_FFT_SIZE+64];
-    unsigned    output[MAX_WIDTH];
-
-    /* tables */
-    Complex     exp_tbl[MAX_FFT_SIZE];
-    int16_t     perm_tbl[MAX_FFT_SIZE/4];
-    float       attack_tbl[MAX_FFT_SIZE/8];
-    uint8_t     padding[1024];
-
-    /* buffers */
-    Complex     fft_buf[MAX_FFT_SIZE+128];
-    ColorF      color_buf[MAX_WIDTH*2];
-    float       rcp_h_buf[MAX_WIDTH];
-
-    /* kernel */
-    KernelIndex kernel_index[MAX_WIDTH*2];
+#define TILE_BINS 4
+#define TILE_STEP (WASM_SIMD ? 4 : 1)
+
+#define KERNEL_BLOB_MAGIC 0x4B514353 /* "SCQK" */
+#define KERNEL_BLOB_VERSION 4
+
+/* serialized kernel, followed by kernel[kernel_size], for compact kernel_scale[t_size], tiles[tile_count],
+ * exp_tbl[fft_tbl_size(fft0)], attack_tbl[attack_size], for mono rfft_tbl[fft_size/4]
+ * and for multires exp_tbl1[fft_tbl_size(fft1)], see fft0_size() and fft1_size() */
+typedef struct KernelBlobHeader {
+    uint32_t    magic;
+    uint32_t    version;
+    int         simd;
+    int         rate;
+    int         width;
+    int         super;
+    int         fft_size;
+    int         attack_size;
+    int         t_size;
+    int         kernel_size;
+    int         mono;
+    int         multires;
+    int         split;
+    int         dec_bits;
+    int         tile_count;
+    int         compact;    /* kernel is int16, padded to 4 bytes */
+    double      fmin;
+    double      fmax;
+} KernelBlobHeader;
+
+/* read-only tables and kernel, shared by contexts with the same (rate, width, super, flags, range) */
+typedef struct ShowCQTTables {
+    struct ShowCQTTables *next;
+    int         refcount;
+
+    /* key */
+    int         rate;
+    int         width;
+    int         super;
+    int         mono;
+    int         multires;
+    int         compact;
+    double      fmin;
+    double      fmax;
+
+    /* props */
+    int         fft_size;
+    int         t_size;
+    int         attack_size;
+    int         kernel_size;
+    int         tile_count;
+    int         rfft_ext;   /* mono: bins past nyquist read by the kernel */
+    int         split;      /* multires: bins from split up use the short window */
+    int         split_tile;
+    int         split_offset;
+    int         dec_bits;   /* multires: decimation stages of the long window */
+
+    /* tables, allocated with this struct */
+    Complex     *exp_tbl;
+    float       *attack_tbl;
+    KernelTile  *tiles;
     float       *kernel;
+    int16_t     *kernel16;      /* compact: the kernel storage as int16, scaled per bin by kernel_scale */
+    float       *kernel_scale;
+    Complex     *rfft_tbl;
+    Complex     *exp_tbl1;
+} ShowCQTTables;
+
+typedef struct ShowCQT {
+    /* buffers sized by init() to fft_size and t_size, one 16 byte aligned block from input[0] */
+    float       *input[2];      /* fft_size + 64 */
+    unsigned    *output;        /* aligned_width */
+    Complex     *fft_buf;       /* fft_size + 128 */
+    Complex     *fft_tmp;       /* fft_size + 1024, the column output of the four-step fft */
+    ColorF      *color_buf;     /* t_size or aligned_width, the larger */
+    float       *rcp_h_buf;     /* aligned_width */
+    ColorF      *smooth_buf;    /* aligned_width, the previous colors of set_smoothing() */
+    float       *peak_buf;      /* aligned_width, bar heights of the set_peak() markers */
+    float       *hold_buf;      /* aligned_width, frames left before each marker falls */
+    ColorF      *delta_buf;     /* aligned_width, prerendered colors of the last render_frame_delta() */
+    float       *delta_peak;    /* aligned_width, its markers */
+    float       *dec_coef;      /* dec_taps, the lowpass of INIT_DECIMATE */
+    float       *dec_hist[2];   /* dec_taps + DEC_BLOCK, input samples not yet decimated */
+
+    /* tables and kernel */
+    ShowCQTTables *tables;
+
+    /* sonogram history, packed rgba ring of sono_lines * width */
+    unsigned    *sono_buf;
+    int         sono_lines;
+    int         sono_head;
 
     /* props */
     int         width;
@@ -114,9 +328,101 @@ typedef struct ShowCQT {
     int         fft_size;
     int         t_size;
     int         attack_size;
+    int         input_pos;  /* ring position of the oldest input sample */
+    int         input_dec;  /* INIT_DECIMATE: input samples per ring sample, else 1 */
+    int         dec_taps;   /* 0 without decimation */
+    int         dec_fill;   /* samples in dec_hist */
+    const float *in[2];     /* input of the running calc(), the ring or a calc_batch() span */
+    int         in_pos;
+    int         in_mask;
     float       sono_v;
     float       bar_v;
+    int         mono;
+    int         multires;
+    int         compact;
+    double      fmin;       /* range of the bins, kept across init() */
+    double      fmax;
+    ColorF      palette;
+    int         smooth;     /* set_smoothing() */
+    float       attack;
+    float       decay;
+    int         peak;       /* set_peak() */
+    float       peak_hold;
+    float       peak_fall;
     int         prerender;
+    float       max_h;          /* highest bar or marker of the prerendered frame */
+    int         delta_valid;    /* delta_dst holds the frame of delta_buf, see render_frame_delta() */
+    const void  *delta_dst;
+    int         delta_stride;
+    int         delta_rows;
+    int         delta_alpha;
+    int         delta_mode;     /* peak of that frame */
+    float       skip_silence;   /* set_skip_static() threshold, < 0 when off */
+    int         last_valid;     /* color_buf is the frame of the input described by last_* */
+    int         last_silent;
+    int         last_pos;
+    float       *last_input;    /* fft_size of each input at the last calc() not silent, see calc_reuse() */
+    int         timing;
+    double      stage_time[STAGE_COUNT];
+#if SHOWCQT_STATS
+    double      stats[STAT_COUNT];
+#endif
 } ShowCQT;
 
+typedef struct DECLARE_ALIGNED(16) MemBlock {
+    struct MemBlock *next;
+    int         size;
+    int         used;
+} MemBlock;
+
+#if SHOWCQT_NATIVE
+/* exports of one native variant, see showcqt-native.c */
+typedef struct ShowCQTApi {
+    void       *(*memory_alloc)(int size);
+    void        (*memory_free)(void *ptr);
+    ShowCQT    *(*create)(void);
+    void        (*destroy)(ShowCQT *cqt);
+    float      *(*get_input_array)(ShowCQT *cqt, int index);
+    unsigned   *(*get_output_array)(ShowCQT *cqt);
+    ColorF     *(*get_color_array)(ShowCQT *cqt);
+    unsigned   *(*get_sono_array)(ShowCQT *cqt);
+    int         (*get_sono_head)(ShowCQT *cqt);
+    int         (*init)(ShowCQT *cqt, int rate, int width, int height, float bar_v, float sono_v, int super, int flags);
+    int         (*kernel_export_size)(ShowCQT *cqt);
+    int         (*kernel_export)(ShowCQT *cqt, uint8_t *dst);
+    int         (*init_import)(ShowCQT *cqt, int rate, int width, int height, float bar_v, float sono_v, int super,
+                               int flags, const uint8_t *src, int size);
+    int         (*init_sono)(ShowCQT *cqt, int lines);
+    int         (*calc)(ShowCQT *cqt);
+    void        (*render_line_alpha)(ShowCQT *cqt, int y, uint8_t alpha);
+    void        (*render_line_opaque)(ShowCQT *cqt, int y);
+    void        (*render_frame)(ShowCQT *cqt, int y0, int y1, uint8_t alpha, unsigned *dst, int stride);
+    void        (*render_sono)(ShowCQT *cqt, int order, uint8_t alpha, unsigned *dst, int stride);
+    void        (*set_volume)(ShowCQT *cqt, float bar_v, float sono_v);
+    int         (*push_samples)(ShowCQT *cqt, const float *src0, const float *src1, int n, int stride);
+    int         (*get_input_pos)(ShowCQT *cqt);
+    void        (*set_palette)(ShowCQT *cqt, float r, float g, float b);
+    void        (*set_height)(ShowCQT *cqt, int height);
+    int         (*detect_silence)(ShowCQT *cqt, float threshold);
+    void        (*calc_batch)(ShowCQT *cqt, const float *src0, const float *src1, int n, int hop, ColorF *dst);
+    void        (*load_color)(ShowCQT *cqt, const ColorF *src);
+    void        (*render_frame_format)(ShowCQT *cqt, int y0, int y1, uint8_t alpha, int format,
+                                       uint8_t *dst, int stride, uint8_t *dst_u, uint8_t *dst_v, int stride_c);
+    void        (*render_sono_format)(ShowCQT *cqt, int order, uint8_t alpha, int format,
+                                      uint8_t *dst, int stride, uint8_t *dst_u, uint8_t *dst_v, int stride_c);
+    int         (*set_range)(ShowCQT *cqt, double fmin, double fmax);
+    void        (*set_timing)(ShowCQT *cqt, int on);
+    double     *(*get_stage_times)(ShowCQT *cqt);
+    double     *(*get_stats)(ShowCQT *cqt);
+    void        (*reset_stats)(ShowCQT *cqt);
+    void        (*set_skip_static)(ShowCQT *cqt, float silence);
+    void        (*set_smoothing)(ShowCQT *cqt, float attack, float decay);
+    void        (*set_peak)(ShowCQT *cqt, int hold, float fall);
+    int         (*render_frame_delta)(ShowCQT *cqt, int y1, uint8_t alpha, unsigned *dst, int stride,
+                                      int *rects, int max_rects);
+    int         (*get_input_dec)(ShowCQT *cqt);
+    void        (*delta_invalidate)(ShowCQT *cqt);
+} ShowCQTApi;
+#endif
+
 #endif
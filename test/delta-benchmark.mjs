@@ -0,0 +1,58 @@
+import ShowCQT from "../showcqt-main.mjs";
+import {argv} from "node:process";
+
+// render_frame_delta() against render_frame() over a run of frames with moving bars and peak markers,
+// every frame of the delta frame must match
+var frames = Number(argv[2] || 60);
+var width  = Number(argv[3] || 1920);
+var height = Number(argv[4] || 1080);
+
+for (let simd of [false, true])
+    for (let rate of [44100, 96000])
+        await benchmark(simd, rate);
+
+async function benchmark(simd, rate) {
+    var cqt   = await ShowCQT.instantiate({simd});
+    var delta = await ShowCQT.instantiate({simd});
+    for (let c of [cqt, delta]) {
+        c.init(rate, width, height, 20, 30, true, height, 0);
+        c.set_peak(30, 0.01);
+    }
+
+    var chunk = Math.round(rate / 60), t_frame = 0, t_delta = 0, rects = 0, mismatch = -1;
+    var left = new Float32Array(chunk), right = new Float32Array(chunk);
+    for (let n = 0; n < frames; n++) {
+        // a sweep and a tone that fades in and out, so bars rise, fall and leave markers behind
+        for (let x = 0; x < chunk; x++) {
+            const t = (n * chunk + x) / rate, f = 100 * Math.pow(2, 6 * n / frames);
+            left[x] = 0.2 * Math.sin(2 * Math.PI * f * t);
+            right[x] = 0.2 * Math.abs(Math.sin(Math.PI * n / 20)) * Math.sin(2 * Math.PI * 3000 * t);
+        }
+        for (let c of [cqt, delta]) {
+            c.push_samples(left, right);
+            c.calc();
+        }
+
+        var t0 = performance.now();
+        cqt.render_frame(0, height);
+        var t1 = performance.now();
+        rects += delta.render_frame_delta(height).length;
+        var t2 = performance.now();
+        t_frame += t1 - t0;
+        t_delta += t2 - t1;
+
+        if (mismatch < 0 && cqt.frame.some((v, x) => v != delta.frame[x]))
+            mismatch = n;
+    }
+
+    console.log(
+        (simd ? "simd" : "scalar").padEnd(6),
+        String(rate).padStart(6),
+        (t_frame / frames).toFixed(3).padStart(8),
+        (t_delta / frames).toFixed(3).padStart(8),
+        (rects / frames).toFixed(1).padStart(5),
+        mismatch < 0 ? "ok" : "MISMATCH at frame " + mismatch
+    );
+    if (mismatch >= 0)
+        process.exitCode = 1;
+}
@@ -0,0 +1,140 @@
+/* Native counterpart of single-benchmark.mjs, built by make native:
+ *     ./showcqt-benchmark name width height rate multi [flags]
+ * name is auto, scalar, avx2 or avx512. The output columns match single-benchmark.mjs,
+ * so the lines can be compared with the wasm ones. Without arguments, every supported
+ * isa runs the width, rate and multi combinations of benchmark.mjs.
+ * The last column is the maxdiff of the rendered rows against the scalar engine, the code of
+ * showcqt.wasm that benchmark.mjs checks against showcqt-ref.mjs. It exits 1 past 1, as benchmark.mjs. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "showcqt-native.h"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+static void fill_input(ShowCQT *cqt, int fft_size, int rate)
+{
+    float *in0 = showcqt_get_input_array(cqt, 0), *in1 = showcqt_get_input_array(cqt, 1);
+    for (int x = 0; x < fft_size; x++) {
+        long t = lround(x / (double) rate * 1e6);
+        in0[x] = 0.1 * ((t % 100000) / 100000.0 - (t % 28765) / 28765.0 + (t % 4341) / 4341.0 - (t % 256) / 256.0);
+        in1[x] = 0.1 * ((t % 125000) / 125000.0 - (t % 18256) / 18256.0 + (t % 8888) / 8888.0 - (t % 128) / 128.0);
+    }
+}
+
+/* rows with the alpha of benchmark.mjs */
+static void render_rows(ShowCQT *cqt, int width, int height, uint32_t *dst)
+{
+    for (int y = 0; y < height; y++) {
+        showcqt_render_line_alpha(cqt, y, y % 256);
+        memcpy(dst + y * width, showcqt_get_output_array(cqt), 4 * width);
+    }
+}
+
+/* the scalar engine on the same input, contexts of one isa only may be alive */
+static int reference_maxdiff(int isa, int width, int height, int rate, int multi, int flags, const uint32_t *rows)
+{
+    int maxdiff = 0;
+    uint32_t *ref = malloc(4 * width * height);
+    showcqt_set_isa(SHOWCQT_ISA_SCALAR);
+    ShowCQT *cqt = showcqt_create();
+    int fft_size = showcqt_init(cqt, rate, width, height - 1, 20, 30, multi, flags);
+    fill_input(cqt, fft_size, rate);
+    showcqt_calc(cqt);
+    render_rows(cqt, width, height, ref);
+    showcqt_destroy(cqt);
+    showcqt_set_isa(isa);
+
+    const uint8_t *a = (const uint8_t *) rows, *b = (const uint8_t *) ref;
+    for (int x = 0; x < 4 * width * height; x++) {
+        int diff = abs(a[x] - b[x]);
+        maxdiff = diff > maxdiff ? diff : maxdiff;
+    }
+    free(ref);
+    return maxdiff;
+}
+
+static int max_maxdiff;
+
+static int benchmark(const char *name, int width, int height, int rate, int multi, int flags)
+{
+    int isa;
+    for (isa = SHOWCQT_ISA_AUTO; isa <= SHOWCQT_ISA_AVX512; isa++)
+        if (!strcmp(name, showcqt_isa_name(isa)))
+            break;
+    if (!showcqt_set_isa(isa)) {
+        fprintf(stderr, "unsupported isa %s\n", name);
+        return 1;
+    }
+
+    ShowCQT *cqt = showcqt_create();
+    double t_init = now();
+    int fft_size = showcqt_init(cqt, rate, width, height - 1, 20, 30, multi, flags);
+    t_init = now() - t_init;
+    if (!fft_size) {
+        fprintf(stderr, "invalid arguments\n");
+        showcqt_destroy(cqt);
+        return 1;
+    }
+
+    fill_input(cqt, fft_size, rate);
+
+    double t0 = now();
+    for (int k = 0; k < 1000; k++)
+        showcqt_calc(cqt);
+    double t1 = now();
+    for (int k = 0; k < 1000; k++) {
+        for (int y = 0; y < height; y++)
+            showcqt_render_line_alpha(cqt, y, 255);
+    }
+    double t2 = now();
+
+    uint32_t *rows = malloc(4 * width * height);
+    render_rows(cqt, width, height, rows);
+    isa = showcqt_get_isa();
+    showcqt_destroy(cqt);
+    int maxdiff = isa == SHOWCQT_ISA_SCALAR ? 0 : reference_maxdiff(isa, width, height, rate, multi, flags, rows);
+    free(rows);
+    max_maxdiff = maxdiff > max_maxdiff ? maxdiff : max_maxdiff;
+
+    printf("%-9s %4d %4d %5d %d %d %5d %8.2f %8.2f %8.2f %3d\n", showcqt_isa_name(isa),
+           width, height, rate, multi, flags, fft_size, t1 - t0, t2 - t1, t_init, maxdiff);
+    fflush(stdout);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) {
+        if (argc < 6) {
+            fprintf(stderr, "usage: %s name width height rate multi [flags]\n", argv[0]);
+            return 1;
+        }
+        if (benchmark(argv[1], atoi(argv[2]), atoi(argv[3]), atoi(argv[4]), atoi(argv[5]), argc > 6 ? atoi(argv[6]) : 0))
+            return 1;
+        return max_maxdiff > 1;
+    }
+
+    static const int widths[] = { 1920, 1600, 1366, 1280, 960, 683, 333 };
+    static const int rates[] = { 96000, 88200, 48000, 44100, 24000, 22050, 11025, 8000 };
+
+    for (int isa = SHOWCQT_ISA_SCALAR; isa <= SHOWCQT_ISA_AVX512; isa++) {
+        if (!showcqt_set_isa(isa))
+            continue;
+        for (int w = 0; w < (int)(sizeof(widths) / sizeof(widths[0])); w++)
+            for (int r = 0; r < (int)(sizeof(rates) / sizeof(rates[0])); r++)
+                for (int multi = 0; multi <= 1; multi++)
+                    benchmark(showcqt_isa_name(isa), widths[w], (widths[w] + 3) / 4, rates[r], multi, 0);
+    }
+    if (max_maxdiff > 1)
+        fprintf(stderr, "maxdiff %d > 1\n", max_maxdiff);
+    return max_maxdiff > 1;
+}
@@ -8,12 +8,15 @@ var width   = Number(argv[3]);
 var height  = Number(argv[4]);
 var rate    = Number(argv[5]);
 var multi   = Number(argv[6]);
+var flags   = Number(argv[7] || 0);
 
-await benchmark(name, width, height, rate, multi);
+await benchmark(name, width, height, rate, multi, flags);
 
-async function benchmark(name, width, height, rate, multi) {
+async function benchmark(name, width, height, rate, multi, flags) {
     var cqt     = await (name == "reference" ? ShowCQTRef : ShowCQT).instantiate({simd: name == "simd"});
-    cqt.init(rate, width, height - 1, 20, 30, multi);
+    var t_init  = performance.now();
+    cqt.init(rate, width, height - 1, 20, 30, multi, 0, 0, flags);
+    t_init      = performance.now() - t_init;
 
     for (let x = 0; x < cqt.fft_size; x++) {
         const t = Math.round(x / rate * 1e6);
@@ -37,8 +40,10 @@ async function benchmark(name, width, height, rate, multi) {
         String(height).padStart(4),
         String(rate).padStart(5),
         String(multi),
+        String(flags),
         String(cqt.fft_size).padStart(5),
         (t1 - t0).toFixed(2).padStart(8),
-        (t2 - t1).toFixed(2).padStart(8)
+        (t2 - t1).toFixed(2).padStart(8),
+        t_init.toFixed(2).padStart(8)
     );
 }
@@ -0,0 +1,141 @@
+
+// Per stage benchmark with JSON output:
+//     node test/stage-benchmark.mjs [--warmup 20] [--iterations 200] [--init-runs 5] [--widths 1920,960] [--heights 480]
+//         [--rates 48000,44100] [--super 0,1] [--simd 0,1] [--output result.json]
+//         [--baseline base.json] [--threshold 0.1] [--stage-threshold fft=0.2,init=0.5] [--min-delta 0.002]
+// Heights default to width / 4. Times are in ms, each init run is cold (new instance, no kernel cache).
+// With --baseline, the medians are compared by combination and the exit status is 1 if a stage got
+// slower than its threshold and by more than min-delta ms.
+
+import {ShowCQT} from "../showcqt-main.mjs";
+import {parseArgs} from "node:util";
+import {readFileSync, writeFileSync} from "node:fs";
+
+var {values: opt} = parseArgs({options: {
+    "warmup":           {type: "string", default: "20"},
+    "iterations":       {type: "string", default: "200"},
+    "init-runs":        {type: "string", default: "5"},
+    "widths":           {type: "string", default: "1920,1366,960,333"},
+    "heights":          {type: "string"},
+    "rates":            {type: "string", default: "96000,48000,44100,22050"},
+    "super":            {type: "string", default: "0,1"},
+    "simd":             {type: "string", default: "0,1"},
+    "output":           {type: "string"},
+    "baseline":         {type: "string"},
+    "threshold":        {type: "string", default: "0.1"},
+    "stage-threshold":  {type: "string", default: ""},
+    "min-delta":        {type: "string", default: "0.002"}
+}});
+
+var list = str => str.split(",").filter(s => s).map(Number);
+var warmup = Number(opt.warmup), iterations = Math.max(1, Number(opt.iterations));
+var init_runs = Math.max(1, Number(opt["init-runs"]));
+var stage_names = ["init", ...ShowCQT.STAGES, "render", "calc"];
+
+ShowCQT.kernel_cache_size = 0;
+
+function percentile(sorted, p) {
+    return sorted[Math.min(sorted.length - 1, Math.ceil(p * sorted.length) - 1)];
+}
+
+function summary(samples) {
+    var sorted = Float64Array.from(samples).sort();
+    return {median: percentile(sorted, 0.5), p95: percentile(sorted, 0.95), p99: percentile(sorted, 0.99)};
+}
+
+async function benchmark(width, height, rate, sup, simd) {
+    var samples = Object.fromEntries(stage_names.map(name => [name, []]));
+    var cqt;
+
+    // a context of the same instance would find the tables of the previous run
+    for (let k = 0; k < init_runs; k++) {
+        cqt?.destroy();
+        cqt = await ShowCQT.instantiate({simd: !!simd});
+        let t = performance.now();
+        cqt.init(rate, width, height - 1, 20, 30, sup);
+        samples.init.push(performance.now() - t);
+    }
+
+    for (let x = 0; x < cqt.fft_size; x++) {
+        const t = Math.round(x / rate * 1e6);
+        cqt.inputs[0][x] = 0.1 * ((t % 100000) / 100000 - (t % 28765) / 28765 + (t % 4341) / 4341 - (t % 256) / 256);
+        cqt.inputs[1][x] = 0.1 * ((t % 125000) / 125000 - (t % 18256) / 18256 + (t % 8888) / 8888 - (t % 128) / 128);
+    }
+
+    for (let k = -warmup; k < iterations; k++) {
+        cqt.set_timing(true);
+        let t0 = performance.now();
+        cqt.calc();
+        let t1 = performance.now();
+        for (let y = 0; y < height; y++)
+            cqt.render_line_alpha(y, 255);
+        let t2 = performance.now();
+        let times = cqt.get_stage_times();
+        if (k < 0)
+            continue;
+        for (let name of ShowCQT.STAGES)
+            samples[name].push(times[name]);
+        samples.calc.push(t1 - t0);
+        samples.render.push(t2 - t1 - times.prerender);
+    }
+    cqt.set_timing(false);
+    var fft_size = cqt.fft_size;
+    cqt.destroy();
+
+    return {
+        key: `${width}x${height} ${rate} super=${sup} simd=${simd}`,
+        width, height, rate, super: sup, simd, fft_size,
+        stages: Object.fromEntries(stage_names.map(name => [name, summary(samples[name])]))
+    };
+}
+
+var results = [];
+for (let width of list(opt.widths))
+    for (let height of opt.heights ? list(opt.heights) : [Math.ceil(width / 4)])
+        for (let rate of list(opt.rates))
+            for (let sup of list(opt.super))
+                for (let simd of list(opt.simd)) {
+                    let r = await benchmark(width, height, rate, sup, simd);
+                    console.error(r.key.padEnd(32), stage_names.map(n => `${n} ${r.stages[n].median.toFixed(3)}`).join("  "));
+                    results.push(r);
+                }
+
+var report = {version: ShowCQT.version, warmup, iterations, init_runs, results};
+
+var exit_code = 0;
+if (opt.baseline) {
+    var base = new Map(JSON.parse(readFileSync(opt.baseline, "utf8")).results.map(r => [r.key, r]));
+    var threshold = Object.fromEntries(stage_names.map(name => [name, Number(opt.threshold)]));
+    for (let item of list_pairs(opt["stage-threshold"]))
+        threshold[item[0]] = item[1];
+    var min_delta = Number(opt["min-delta"]);
+    report.regressions = [];
+    for (let r of results) {
+        let b = base.get(r.key);
+        if (!b)
+            continue;
+        for (let name of stage_names) {
+            let now = r.stages[name].median, was = b.stages[name]?.median;
+            if (was === undefined || now - was <= min_delta || now <= was * (1 + threshold[name]))
+                continue;
+            report.regressions.push({key: r.key, stage: name, baseline: was, median: now, ratio: now / was});
+            console.error(`REGRESSION ${r.key} ${name}: ${was.toFixed(3)} -> ${now.toFixed(3)} ms`);
+        }
+    }
+    exit_code = report.regressions.length ? 1 : 0;
+}
+
+var json = JSON.stringify(report, null, 2);
+if (opt.output)
+    writeFileSync(opt.output, json + "\n");
+else
+    console.log(json);
+process.exitCode = exit_code;
+
+function list_pairs(str) {
+    return str.split(",").filter(s => s).map(s => s.split("=")).map(([name, value]) => {
+        if (!stage_names.includes(name))
+            throw new Error(`unknown stage ${name}`);
+        return [name, Number(value)];
+    });
+}
@@ -0,0 +1,47 @@
+import ShowCQT from "../showcqt-main.mjs";
+import {argv} from "node:process";
+
+var threads = Number(argv[2] || 4);
+var width   = Number(argv[3] || 1920);
+var height  = Number(argv[4] || 1080);
+
+for (let flags of [0, ShowCQT.MONO, ShowCQT.MULTIRES])
+    for (let rate of [44100, 48000, 96000])
+        await benchmark(rate, flags);
+
+async function benchmark(rate, flags) {
+    var cqt     = await ShowCQT.instantiate({simd: true});
+    var cqt_mt  = await ShowCQT.instantiate({threads});
+    cqt.init(rate, width, height - 1, 20, 30, true, 0, 0, flags);
+    cqt_mt.init(rate, width, height - 1, 20, 30, true, 0, 0, flags);
+
+    for (let x = 0; x < cqt.fft_size; x++) {
+        const t = Math.round(x / rate * 1e6);
+        cqt.inputs[0][x] = 0.1 * ((t % 100000) / 100000 - (t % 28765) / 28765 + (t % 4341) / 4341 - (t % 256) / 256);
+        cqt.inputs[1][x] = 0.1 * ((t % 125000) / 125000 - (t % 18256) / 18256 + (t % 8888) / 8888 - (t % 128) / 128);
+    }
+    cqt_mt.inputs[0].set(cqt.inputs[0]);
+    cqt_mt.inputs[1].set(cqt.inputs[1]);
+
+    var t0 = performance.now();
+    for (let k = 0; k < 1000; k++)
+        cqt.calc();
+    var t1 = performance.now();
+    for (let k = 0; k < 1000; k++)
+        cqt_mt.calc();
+    var t2 = performance.now();
+
+    var mismatch = cqt.color.some((v, x) => !Object.is(v, cqt_mt.color[x]));
+    cqt_mt.terminate_threads();
+
+    console.log(
+        ["stereo", "mono", "multires"][flags].padEnd(8),
+        String(rate).padStart(6),
+        String(cqt.fft_size).padStart(5),
+        (t1 - t0).toFixed(2).padStart(8),
+        (t2 - t1).toFixed(2).padStart(8),
+        mismatch ? "MISMATCH" : "ok"
+    );
+    if (mismatch)
+        process.exitCode = 1;
+}